@@ -4,7 +4,7 @@
 #include <fstream>
 #include "profiler.hpp"  
 
-void customProfilerOutput(const std::string& id, profiler::profilerClock::duration t) {
+void customProfilerOutput(std::string_view id, profiler::profilerClock::duration t) {
     *profiler::defaultProfilerOutputStream << "(custom output) " 
                                            << id << " took " 
                                            << std::chrono::duration<double>(t).count() * profiler::profilerDurationScale 
@@ -59,8 +59,9 @@ int main() {
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
 
-    // change profiler clock
-    PF_SET_PROFILER_CLOCK(std::chrono::system_clock);
+    // the profiler clock is chosen at compile time by defining PF_CLOCK before including profiler.hpp,
+    // e.g. profiler::TscClock, or profiler::FunctionClock to switch it at runtime with
+    // PF_SET_PROFILER_CLOCK(std::chrono::system_clock)
 
     // change profiler duration unit (seconds, milliseconds, etc)
     PF_SET_PROFILER_DURATION_UNIT(std::chrono::minutes);
@@ -83,6 +84,9 @@ int main() {
         PF_AVERAGE_TIMER("avg timer");
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
+
+    // stop automatic logging, reporting what is left, before the file goes away
+    PF_STOP_AUTO_LOG();
     file.close();
 
 }
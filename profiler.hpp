@@ -6,6 +6,143 @@
 #include <thread>
 #include <iomanip>
 #include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <queue>
+#include <fstream>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <tuple>
+#include <deque>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+#include <type_traits>
+#include <algorithm>
+#include <iterator>
+#include <sstream>
+#include <string_view>
+#include <ratio>
+#include <charconv>
+#include <optional>
+#include <cstdio>
+
+#include <cstring>
+#include <cstdlib>
+#include <new>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <cerrno>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#ifdef __linux__
+#include <sched.h>
+#include <dirent.h>
+#endif
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#include <time.h>
+#include <ucontext.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#define PF_HAS_SAMPLER 1
+#endif
+
+#if defined(__linux__) && __has_include(<linux/perf_event.h>)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#define PF_HAS_PERF_EVENTS 1
+#endif
+
+// PF_ENABLED 0 compiles every probe macro out, PF_CATEGORY_MASK keeps only the
+// PF_*_CAT probes whose category has a bit in the mask (PF_* probes use CAT_DEFAULT)
+#ifndef PF_ENABLED
+#define PF_ENABLED 1
+#endif
+
+#ifndef PF_CATEGORY_MASK
+#define PF_CATEGORY_MASK (~0ull)
+#endif
+
+#ifndef PF_THREAD_BUFFER_CAPACITY
+#define PF_THREAD_BUFFER_CAPACITY 4096
+#endif
+
+#ifndef PF_TRACE_CHUNK_SIZE
+#define PF_TRACE_CHUNK_SIZE 4096
+#endif
+
+// ids that can be switched off one by one at run time, ids past it only follow the global switch
+#ifndef PF_MAX_FILTERED_IDS
+#define PF_MAX_FILTERED_IDS 16384
+#endif
+
+// cpu shards of PF_ENABLE_CPU_SHARDS, higher cpu numbers share a shard
+#ifndef PF_MAX_CPUS
+#define PF_MAX_CPUS 512
+#endif
+
+#ifndef PF_ASYNC_OUTPUT_CAPACITY
+#define PF_ASYNC_OUTPUT_CAPACITY 8192
+#endif
+
+#ifndef PF_BINARY_LOG_BLOCK_RECORDS
+#define PF_BINARY_LOG_BLOCK_RECORDS 256
+#endif
+
+#ifndef PF_BINARY_LOG_STRING_TABLE_SIZE
+#define PF_BINARY_LOG_STRING_TABLE_SIZE 65536
+#endif
+
+// default hard cap on the profiler's own storage, PF_SET_ARENA_CAPACITY changes it at runtime
+#ifndef PF_ARENA_CAPACITY
+#define PF_ARENA_CAPACITY (256ull << 20)
+#endif
+
+#ifndef PF_ARENA_REGION_SIZE
+#define PF_ARENA_REGION_SIZE (1ull << 20)
+#endif
+
+// frames over budget whose breakdown is kept per frame name until the next report
+#ifndef PF_WORST_FRAMES
+#define PF_WORST_FRAMES 8
+#endif
+
+// frames kept per stack sample of PF_START_SAMPLER, and samples the signal handler can queue
+// before the reporter thread drains them
+#ifndef PF_SAMPLER_MAX_DEPTH
+#define PF_SAMPLER_MAX_DEPTH 64
+#endif
+
+#ifndef PF_SAMPLER_QUEUE_CAPACITY
+#define PF_SAMPLER_QUEUE_CAPACITY 4096
+#endif
+
+// bytes per block of raw samples, including the block header
+#ifndef PF_SAMPLE_BLOCK_SIZE
+#define PF_SAMPLE_BLOCK_SIZE 4096
+#endif
 
 namespace profiler {
 
@@ -20,256 +157,5887 @@ static const std::map<long long, std::string_view> timeSuffixes = {
 };
 
 std::string_view getUnitSuffix(double scale) {
-    auto it = profiler::timeSuffixes.find((1/scale) * 1000000000LL);
+    auto it = profiler::timeSuffixes.find(std::llround(1000000000.0 / scale));
     return it != profiler::timeSuffixes.end() ? it->second : "?";
 }
 
+template <typename periodT>
+constexpr std::string_view unitSuffix() {
+    if constexpr(std::ratio_equal_v<periodT, std::nano>) return "ns";
+    else if constexpr(std::ratio_equal_v<periodT, std::micro>) return "us";
+    else if constexpr(std::ratio_equal_v<periodT, std::milli>) return "ms";
+    else if constexpr(std::ratio_equal_v<periodT, std::ratio<1>>) return "s";
+    else if constexpr(std::ratio_equal_v<periodT, std::ratio<60>>) return "min";
+    else if constexpr(std::ratio_equal_v<periodT, std::ratio<3600>>) return "h";
+    else if constexpr(std::ratio_equal_v<periodT, std::ratio<86400>>) return "d";
+    else return "?";
+}
+
+using duration = std::chrono::high_resolution_clock::duration;
+using ticks = std::int64_t;
+
+// clock policies, selected at compile time with PF_CLOCK. now() returns raw ticks
+// and toDuration()/toTicks() convert them, which only happens when reporting
+template <typename clockT>
+struct ChronoClock {
+    static ticks now() {
+        return (ticks)clockT::now().time_since_epoch().count();
+    }
+    static duration toDuration(ticks t) {
+        return std::chrono::duration_cast<duration>(typename clockT::duration(t));
+    }
+    static ticks toTicks(duration d) {
+        return (ticks)std::chrono::duration_cast<typename clockT::duration>(d).count();
+    }
+};
+
+// runtime switchable through setProfilerClock<clockT>(), costs an indirect call per read
+struct FunctionClock {
+    static std::function<duration()> nowFunction;
+
+    static ticks now() {
+        return nowFunction().count();
+    }
+    static duration toDuration(ticks t) {
+        return duration(t);
+    }
+    static ticks toTicks(duration d) {
+        return d.count();
+    }
+};
+std::function<duration()> FunctionClock::nowFunction = [] { return std::chrono::high_resolution_clock::now().time_since_epoch(); };
+
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+#define PF_HAS_TSC_CLOCK 1
+
+// invariant TSC on x86, the virtual counter on ARM. the x86 tick rate is calibrated
+// against steady_clock the first time ticks are converted, over at least calibrationWindow
+struct TscClock {
+    static constexpr std::chrono::milliseconds calibrationWindow{20};
+
+    static ticks now() {
+#if defined(__aarch64__)
+        std::uint64_t v;
+        asm volatile("isb; mrs %0, cntvct_el0" : "=r"(v) :: "memory");
+        return (ticks)v;
+#else
+        unsigned int aux;
+        return (ticks)__rdtscp(&aux);
+#endif
+    }
+
+    static bool invariant() {
+#if defined(__aarch64__)
+        return true;
+#else
+        unsigned int eax, ebx, ecx, edx;
+        if(!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) return false;
+        return (edx & (1u << 8)) != 0;
+#endif
+    }
+
+    static double nsPerTick() {
+        static const double value = calibrate();
+        return value;
+    }
+
+    static duration toDuration(ticks t) {
+        return duration((duration::rep)((double)t * nsPerTick()));
+    }
+    static ticks toTicks(duration d) {
+        return (ticks)((double)d.count() / nsPerTick());
+    }
+
+private:
+    struct CalibrationPoint {
+        std::chrono::steady_clock::time_point wall = std::chrono::steady_clock::now();
+        ticks tsc = TscClock::now();
+    };
+    static const CalibrationPoint calibrationStart;
+
+    static double calibrate() {
+#if defined(__aarch64__)
+        std::uint64_t freq;
+        asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+        return 1e9 / (double)freq;
+#else
+        if(!invariant()) std::cerr << "profiler: TSC is not invariant, TscClock durations may be unreliable\n";
+        auto elapsed = std::chrono::steady_clock::now() - calibrationStart.wall;
+        if(elapsed < calibrationWindow) std::this_thread::sleep_for(calibrationWindow - elapsed);
+        CalibrationPoint end;
+        auto wallNs = std::chrono::duration_cast<std::chrono::nanoseconds>(end.wall - calibrationStart.wall).count();
+        return (double)wallNs / (double)(end.tsc - calibrationStart.tsc);
+#endif
+    }
+};
+const TscClock::CalibrationPoint TscClock::calibrationStart;
+#endif
+
+}
+
+#ifndef PF_CLOCK
+#define PF_CLOCK profiler::ChronoClock<std::chrono::high_resolution_clock>
+#endif
+
+namespace profiler {
+
 class profilerClock {
 public:
-    using duration = std::chrono::high_resolution_clock::duration;
+    using source = PF_CLOCK;
+    using duration = profiler::duration;
+    using ticks = profiler::ticks;
     using time_point = std::chrono::high_resolution_clock::time_point;
-    static std::function<duration()> nowFunction;
+
+    static ticks nowTicks() {
+        return source::now();
+    }
+
+    static duration toDuration(ticks t) {
+        return source::toDuration(t);
+    }
+
+    static ticks toTicks(duration d) {
+        return source::toTicks(d);
+    }
 
     static duration now() {
-        return nowFunction();
+        return toDuration(nowTicks());
     }
 };
-std::function<profilerClock::duration()> profilerClock::nowFunction = [] { return std::chrono::high_resolution_clock::now().time_since_epoch(); };
 
 template <typename clockT>
 void setProfilerClock() {
-    profilerClock::nowFunction = [] {
-        return std::chrono::duration_cast<profilerClock::duration>(
+    static_assert(std::is_same_v<profilerClock::source, FunctionClock> && sizeof(clockT),
+                  "setProfilerClock needs PF_CLOCK to be profiler::FunctionClock");
+    FunctionClock::nowFunction = [] {
+        return std::chrono::duration_cast<duration>(
             clockT::now().time_since_epoch()
         );
     };
 }
 
+// the suffix is resolved with the scale, so output functions never look it up
 inline double profilerDurationScale = 1.0;
+inline std::string_view profilerDurationSuffix = "s";
 template <typename durationT>
 void setProfilerDurationScale() {
     profilerDurationScale = (double)durationT::period::den / (double)durationT::period::num;
+    profilerDurationSuffix = unitSuffix<typename durationT::period>();
 }
 
-using ProfilerOutputFunction = std::function<void(const std::string&, profilerClock::duration)>;
-using AverageTimerInfoOutputFunction = std::function<void(profilerClock::duration)>;
+inline double scaledDuration(profilerClock::duration t) {
+    return std::chrono::duration<double>(t).count() * profilerDurationScale;
+}
 
-std::ostream* defaultProfilerOutputStream = &std::cout;
+// sum, min and max of a contiguous run of samples
+struct SampleMoments {
+    ticks sum = 0;
+    ticks min = std::numeric_limits<ticks>::max();
+    ticks max = std::numeric_limits<ticks>::min();
+};
 
-void id_took_t_suffix(const std::string& id, profilerClock::duration t) {
-    *defaultProfilerOutputStream
-            << std::setprecision(6)
-            << "|| " << id << " took "
-            << std::chrono::duration<double>(t).count() * profilerDurationScale
-            << getUnitSuffix(profilerDurationScale) << "\n";
+inline SampleMoments reduceSamplesScalar(const ticks* p, std::size_t n, SampleMoments m = {}) {
+    for(std::size_t i = 0; i < n; i++) {
+        m.sum += p[i];
+        m.min = std::min(m.min, p[i]);
+        m.max = std::max(m.max, p[i]);
+    }
+    return m;
 }
 
-void id_colon_t_suffix(const std::string& id, profilerClock::duration t) {
-    *defaultProfilerOutputStream
-            << std::setprecision(6)
-            << "|| " << id << ": "
-            << std::chrono::duration<double>(t).count() * profilerDurationScale
-            << getUnitSuffix(profilerDurationScale) << "\n";
+#if defined(__x86_64__) && defined(__GNUC__)
+#define PF_HAS_AVX_REDUCTION 1
+
+// avx2 has no 64 bit min and max, they are a compare and a blend
+__attribute__((target("avx2")))
+inline SampleMoments reduceSamplesAvx2(const ticks* p, std::size_t n) {
+    SampleMoments m;
+    __m256i sum = _mm256_setzero_si256();
+    __m256i lo = _mm256_set1_epi64x(m.min);
+    __m256i hi = _mm256_set1_epi64x(m.max);
+    std::size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        sum = _mm256_add_epi64(sum, v);
+        lo = _mm256_blendv_epi8(lo, v, _mm256_cmpgt_epi64(lo, v));
+        hi = _mm256_blendv_epi8(hi, v, _mm256_cmpgt_epi64(v, hi));
+    }
+    alignas(32) ticks sums[4], mins[4], maxs[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(sums), sum);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(mins), lo);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(maxs), hi);
+    for(std::size_t lane = 0; lane < 4; lane++) {
+        m.sum += sums[lane];
+        m.min = std::min(m.min, mins[lane]);
+        m.max = std::max(m.max, maxs[lane]);
+    }
+    return reduceSamplesScalar(p + i, n - i, m);
 }
 
-void id_colon_t_suffix_out_of_sleepduration(const std::string&, profilerClock::duration);
+// gcc 12 warns about the undefined vectors inside its own avx512 intrinsics
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f")))
+inline SampleMoments reduceSamplesAvx512(const ticks* p, std::size_t n) {
+    SampleMoments m;
+    __m512i sum = _mm512_setzero_si512();
+    __m512i lo = _mm512_set1_epi64(m.min);
+    __m512i hi = _mm512_set1_epi64(m.max);
+    std::size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        __m512i v = _mm512_loadu_si512(p + i);
+        sum = _mm512_add_epi64(sum, v);
+        lo = _mm512_min_epi64(lo, v);
+        hi = _mm512_max_epi64(hi, v);
+    }
+    // the tail is a masked load, lanes past the end keep values that change nothing
+    __mmask8 tail = static_cast<__mmask8>((1u << (n - i)) - 1);
+    sum = _mm512_add_epi64(sum, _mm512_maskz_loadu_epi64(tail, p + i));
+    lo = _mm512_min_epi64(lo, _mm512_mask_loadu_epi64(lo, tail, p + i));
+    hi = _mm512_max_epi64(hi, _mm512_mask_loadu_epi64(hi, tail, p + i));
+    m.sum = _mm512_reduce_add_epi64(sum);
+    m.min = _mm512_reduce_min_epi64(lo);
+    m.max = _mm512_reduce_max_epi64(hi);
+    return m;
+}
+#pragma GCC diagnostic pop
+#endif
 
-void elapsed_time_colon_t_suffix(profilerClock::duration);
+#if defined(__aarch64__) && defined(__ARM_NEON)
+inline SampleMoments reduceSamplesNeon(const ticks* p, std::size_t n) {
+    SampleMoments m;
+    int64x2_t sum = vdupq_n_s64(0);
+    int64x2_t lo = vdupq_n_s64(m.min);
+    int64x2_t hi = vdupq_n_s64(m.max);
+    std::size_t i = 0;
+    for(; i + 2 <= n; i += 2) {
+        int64x2_t v = vld1q_s64(p + i);
+        sum = vaddq_s64(sum, v);
+        lo = vbslq_s64(vcltq_s64(v, lo), v, lo);
+        hi = vbslq_s64(vcgtq_s64(v, hi), v, hi);
+    }
+    m.sum = vgetq_lane_s64(sum, 0) + vgetq_lane_s64(sum, 1);
+    m.min = std::min(vgetq_lane_s64(lo, 0), vgetq_lane_s64(lo, 1));
+    m.max = std::max(vgetq_lane_s64(hi, 0), vgetq_lane_s64(hi, 1));
+    return reduceSamplesScalar(p + i, n - i, m);
+}
+#endif
 
-ProfilerOutputFunction defaultProfilerOutputFunction = id_took_t_suffix;
-ProfilerOutputFunction defaultCumulativeTimerOutputFunction = id_colon_t_suffix_out_of_sleepduration;
-AverageTimerInfoOutputFunction defaultAverageTimerInfoOutputFunction = elapsed_time_colon_t_suffix;
+// picks the widest kernel the cpu supports, once
+inline SampleMoments reduceSamples(const ticks* p, std::size_t n) {
+#ifdef PF_HAS_AVX_REDUCTION
+    static const int level = __builtin_cpu_supports("avx512f") ? 2 : __builtin_cpu_supports("avx2") ? 1 : 0;
+    if(level == 2) return reduceSamplesAvx512(p, n);
+    if(level == 1) return reduceSamplesAvx2(p, n);
+    return reduceSamplesScalar(p, n);
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    return reduceSamplesNeon(p, n);
+#else
+    return reduceSamplesScalar(p, n);
+#endif
+}
 
-profilerClock::duration defaultAverageTimerSleepDuration = std::chrono::seconds(1);
-profilerClock::duration defaultCumulativeTimerSleepDuration = std::chrono::seconds(1);
+// sum of squared deviations from mean, independent accumulators so the adds pipeline
+inline double squaredDeviations(const ticks* p, std::size_t n, double mean) {
+    double acc[4] = {};
+    std::size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        for(std::size_t lane = 0; lane < 4; lane++) {
+            double d = (double)p[i + lane] - mean;
+            acc[lane] += d * d;
+        }
+    }
+    for(; i < n; i++) {
+        double d = (double)p[i] - mean;
+        acc[0] += d * d;
+    }
+    return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
 
-class Timer {
-    profilerClock::duration begin;
-public:
-    void start() {
-        begin = profilerClock::now();
+// nearest rank percentiles of [begin, end) like Histogram::percentile, in the order of ps.
+// reorders the range, each selection only searches what is above the previous one
+inline std::vector<ticks> selectPercentiles(ticks* begin, ticks* end, const std::vector<double>& ps) {
+    std::vector<ticks> result(ps.size(), 0);
+    std::size_t n = end - begin;
+    if(n == 0) return result;
+    std::vector<std::pair<std::size_t, std::size_t>> ranks; // (index into the range, index into ps)
+    for(std::size_t i = 0; i < ps.size(); i++) {
+        std::size_t rank = (std::size_t)std::ceil(std::clamp(ps[i], 0.0, 100.0) / 100.0 * (double)n);
+        ranks.emplace_back(std::clamp<std::size_t>(rank, 1, n) - 1, i);
     }
-    profilerClock::duration stop() {
-        return profilerClock::now() - begin;
+    std::sort(ranks.begin(), ranks.end());
+    ticks* from = begin;
+    for(auto& [index, i] : ranks) {
+        if(begin + index >= from) {
+            std::nth_element(from, begin + index, end);
+            from = begin + index + 1;
+        }
+        result[i] = begin[index];
+    }
+    return result;
+}
+
+// count, sum, min, max and welford mean/variance, constant size regardless of the sample rate
+// kept in clock ticks, the accessors convert to durations
+struct RunningStats {
+    std::uint64_t count = 0;
+    ticks sum = 0;
+    ticks min = std::numeric_limits<ticks>::max();
+    ticks max = std::numeric_limits<ticks>::min();
+    double mean = 0.0;
+    double m2 = 0.0;
+
+    // weight > 1 stands for a sample that represents that many calls
+    void add(ticks t, std::uint64_t weight = 1) {
+        count += weight;
+        sum += t * (ticks)weight;
+        if(t < min) min = t;
+        if(t > max) max = t;
+        double delta = (double)t - mean;
+        mean += delta * (double)weight / (double)count;
+        m2 += (double)weight * delta * ((double)t - mean);
+    }
+
+    // a whole block at once: min, max and sum in one vectorized pass, then the squared
+    // deviations over the same block while it is still in cache
+    void addSamples(const ticks* p, std::size_t n) {
+        if(n == 0) return;
+        SampleMoments m = reduceSamples(p, n);
+        RunningStats block;
+        block.count = n;
+        block.sum = m.sum;
+        block.min = m.min;
+        block.max = m.max;
+        block.mean = (double)m.sum / (double)n;
+        block.m2 = squaredDeviations(p, n, block.mean);
+        merge(block);
+    }
+
+    void merge(const RunningStats& other) {
+        if(other.count == 0) return;
+        if(count == 0) { *this = other; return; }
+        std::uint64_t n = count + other.count;
+        double delta = other.mean - mean;
+        mean += delta * (double)other.count / (double)n;
+        m2 += other.m2 + delta * delta * (double)count * (double)other.count / (double)n;
+        count = n;
+        sum += other.sum;
+        if(other.min < min) min = other.min;
+        if(other.max > max) max = other.max;
+    }
+
+    profilerClock::duration total() const {
+        return profilerClock::toDuration(sum);
+    }
+
+    profilerClock::duration average() const {
+        return count ? profilerClock::toDuration(sum / (ticks)count) : profilerClock::duration::zero();
+    }
+
+    profilerClock::duration minimum() const {
+        return count ? profilerClock::toDuration(min) : profilerClock::duration::zero();
+    }
+
+    profilerClock::duration maximum() const {
+        return count ? profilerClock::toDuration(max) : profilerClock::duration::zero();
+    }
+
+    // in squared ticks
+    double variance() const {
+        return count > 1 ? m2 / (double)(count - 1) : 0.0;
+    }
+
+    profilerClock::duration stddev() const {
+        return profilerClock::toDuration((ticks)std::sqrt(variance()));
     }
 };
 
-class AverageTimerManager {
-    static std::mutex collectedAverageTimesMapMutex;
-    static std::map<std::string, std::vector<profilerClock::duration>> collectedAverageTimesMap;
+inline unsigned highestBit(std::uint64_t v) {
+#if defined(__GNUC__)
+    return 63u - (unsigned)__builtin_clzll(v);
+#else
+    unsigned bit = 0;
+    while(v >>= 1) bit++;
+    return bit;
+#endif
+}
 
-    static std::mutex collectedCumulativeTimesMapMutex;
-    static std::map<std::string, std::vector<profilerClock::duration>> collectedCumulativeTimesMap;
+// log-linear (HDR style) histogram over tick values with fixed memory. values below
+// subBucketCount are exact, above that every power of two is split into subBucketCount
+// linear sub-buckets, so the relative error of any reported value stays under 1/subBucketCount
+class Histogram {
+public:
+    static constexpr unsigned subBucketBits = 5;
+    static constexpr std::size_t subBucketCount = std::size_t(1) << subBucketBits;
+    static constexpr std::size_t bucketCount = (64 - subBucketBits + 1) * subBucketCount;
+
+private:
+    std::uint64_t counts[bucketCount] = {};
+    std::uint64_t totalCount = 0;
+    ticks totalSum = 0;
+    ticks minValue = std::numeric_limits<ticks>::max();
+    ticks maxValue = 0;
+
+    static std::size_t bucketIndex(std::uint64_t v) {
+        if(v < subBucketCount) return (std::size_t)v;
+        unsigned shift = highestBit(v) - subBucketBits;
+        return (std::size_t)(shift + 1) * subBucketCount + (std::size_t)((v >> shift) - subBucketCount);
+    }
+
+    // midpoint of the range of values that land in the bucket
+    static ticks bucketValue(std::size_t index) {
+        if(index < 2 * subBucketCount) return (ticks)index;
+        unsigned shift = (unsigned)(index / subBucketCount) - 1;
+        std::uint64_t lower = (std::uint64_t)(index % subBucketCount + subBucketCount) << shift;
+        return (ticks)(lower + (std::uint64_t(1) << shift) / 2);
+    }
 
-    static profilerClock::duration profilerStartTime;
-    static bool startTimeSet;
-    static bool loggingEnabled;
 public:
+    void record(ticks t, std::uint64_t n = 1) {
+        if(t < 0) t = 0;
+        counts[bucketIndex((std::uint64_t)t)] += n;
+        totalCount += n;
+        totalSum += t * (ticks)n;
+        if(t < minValue) minValue = t;
+        if(t > maxValue) maxValue = t;
+    }
 
-    static void setStartTime(profilerClock::duration t) {
-        profilerStartTime = t;
-        startTimeSet = true;
+    void merge(const Histogram& other) {
+        if(other.totalCount == 0) return;
+        for(std::size_t i = 0; i < bucketCount; i++) counts[i] += other.counts[i];
+        totalCount += other.totalCount;
+        totalSum += other.totalSum;
+        if(other.minValue < minValue) minValue = other.minValue;
+        if(other.maxValue > maxValue) maxValue = other.maxValue;
     }
 
-    static void averageLog() {
-        std::lock_guard<std::mutex> lock(collectedAverageTimesMapMutex);
-        for(auto& p : collectedAverageTimesMap) {
-            profilerClock::duration avg = std::chrono::seconds(0);
-            for(auto& t : p.second) avg += t;
-            avg /= p.second.size();
-            defaultAverageTimerInfoOutputFunction(profilerStartTime);
-            defaultProfilerOutputFunction(p.first, avg);
-        }
+    void clear() {
+        if(totalCount == 0) return;
+        std::fill(std::begin(counts), std::end(counts), 0);
+        totalCount = 0;
+        totalSum = 0;
+        minValue = std::numeric_limits<ticks>::max();
+        maxValue = 0;
     }
 
-    static void cumulativeLog() {
-        std::lock_guard<std::mutex> lock(collectedCumulativeTimesMapMutex);
-        for(auto& p : collectedCumulativeTimesMap) {
-            profilerClock::duration total = std::chrono::seconds(0);
-            for(auto& t : p.second) total += t;
-            defaultAverageTimerInfoOutputFunction(profilerStartTime);
-            defaultCumulativeTimerOutputFunction(p.first, total);
-        }
+    std::uint64_t count() const {
+        return totalCount;
     }
 
-    static void addAverageTime(const std::string& id, profilerClock::duration t) {
-        std::lock_guard<std::mutex> lock(collectedAverageTimesMapMutex);
-        collectedAverageTimesMap[id].push_back(t);
+    // exact, not derived from the buckets
+    ticks sum() const {
+        return totalSum;
     }
 
-    static void addCumulativeTime(const std::string& id, profilerClock::duration t) {
-        std::lock_guard<std::mutex> lock(collectedCumulativeTimesMapMutex);
-        collectedCumulativeTimesMap[id + " (cumulative)"].push_back(t);
+    // values in buckets up to the one v falls into, so off by at most the bucket width
+    std::uint64_t countAtOrBelow(ticks v) const {
+        if(v < 0) return 0;
+        std::size_t last = bucketIndex((std::uint64_t)v);
+        std::uint64_t n = 0;
+        for(std::size_t i = 0; i <= last; i++) n += counts[i];
+        return n;
     }
 
-    static void averageLogLoop() {
-        while(true) {
-            std::this_thread::sleep_for(defaultAverageTimerSleepDuration);
-            averageLog();
-            std::lock_guard<std::mutex> lock(collectedAverageTimesMapMutex);
-            collectedAverageTimesMap.clear();
+    // percentile in [0, 100], clamped to the exact min and max
+    profilerClock::duration percentile(double p) const {
+        if(totalCount == 0) return profilerClock::duration::zero();
+        std::uint64_t target = (std::uint64_t)std::ceil(p / 100.0 * (double)totalCount);
+        if(target == 0) target = 1;
+        if(target >= totalCount) return profilerClock::toDuration(maxValue);
+        std::uint64_t seen = 0;
+        for(std::size_t i = 0; i < bucketCount; i++) {
+            seen += counts[i];
+            if(seen >= target) return profilerClock::toDuration(std::clamp(bucketValue(i), minValue, maxValue));
         }
+        return profilerClock::toDuration(maxValue);
     }
 
-    static void cumulativeLogLoop() {
-        while(true) {
-            std::this_thread::sleep_for(defaultCumulativeTimerSleepDuration);
-            cumulativeLog();
-            std::lock_guard<std::mutex> lock(collectedCumulativeTimesMapMutex);
-            collectedCumulativeTimesMap.clear();
-        }
+    profilerClock::duration minimum() const {
+        return totalCount ? profilerClock::toDuration(minValue) : profilerClock::duration::zero();
     }
 
-    static void startAverageLoggingThread() {
-        if(!startTimeSet) setStartTime(profilerClock::now());
-        if(!loggingEnabled) {
-            std::thread t(averageLogLoop);
-            if (t.joinable()) {
-                t.detach();
-                startTimeSet = true;
-            } else std::cerr << "could not detach average timer thread\n";
+    profilerClock::duration maximum() const {
+        return profilerClock::toDuration(maxValue);
+    }
+};
+
+// hardware counters a perf scope can read, combined into a mask. the names can be used unqualified in PF_PERF_SCOPE_COUNTERS
+namespace counters {
+constexpr std::uint32_t PERF_CYCLES = 1u << 0;
+constexpr std::uint32_t PERF_INSTRUCTIONS = 1u << 1;
+constexpr std::uint32_t PERF_LLC_MISSES = 1u << 2;
+constexpr std::uint32_t PERF_BRANCH_MISSES = 1u << 3;
+constexpr std::uint32_t PERF_ALL = PERF_CYCLES | PERF_INSTRUCTIONS | PERF_LLC_MISSES | PERF_BRANCH_MISSES;
+}
+
+constexpr std::size_t perfCounterCount = 4;
+inline const char* const perfCounterNames[perfCounterCount] = {"cycles", "instructions", "llc misses", "branch misses"};
+
+// no counters at all means every counter
+template <typename... CounterT>
+constexpr std::uint32_t perfCounterMask(CounterT... c) {
+    if constexpr(sizeof...(c) == 0) return counters::PERF_ALL;
+    else return (static_cast<std::uint32_t>(c) | ...);
+}
+
+// wall time and counter deltas of one perf scope id
+struct PerfStats {
+    RunningStats time;
+    std::uint64_t totals[perfCounterCount] = {};
+    std::uint64_t scopes[perfCounterCount] = {}; // scopes that read each counter
+
+    void add(profilerClock::ticks t, std::uint32_t mask, const std::uint64_t* deltas) {
+        time.add(t);
+        for(std::size_t i = 0; i < perfCounterCount; i++) {
+            if(!(mask & (1u << i))) continue;
+            totals[i] += deltas[i];
+            scopes[i]++;
         }
     }
 
-    static void startCumulativeLoggingThread() {
-        if(!startTimeSet) setStartTime(profilerClock::now());
-        if(!loggingEnabled) {
-            std::thread t(cumulativeLogLoop);
-            if (t.joinable()) {
-                t.detach();
-                startTimeSet = true;
-            } else std::cerr << "could not detach cumulative timer thread\n";
+    void merge(const PerfStats& other) {
+        time.merge(other.time);
+        for(std::size_t i = 0; i < perfCounterCount; i++) {
+            totals[i] += other.totals[i];
+            scopes[i] += other.scopes[i];
         }
     }
+
+    bool counted(std::size_t i) const { return scopes[i] != 0; }
+
+    // per scope
+    double average(std::size_t i) const {
+        return scopes[i] ? double(totals[i]) / scopes[i] : 0.0;
+    }
+
+    // instructions per cycle, 0 unless both were counted
+    double ipc() const {
+        return totals[0] && counted(1) ? double(totals[1]) / totals[0] : 0.0;
+    }
+
+    // events per thousand instructions
+    double perKiloInstruction(std::size_t i) const {
+        return totals[1] ? 1000.0 * totals[i] / totals[1] : 0.0;
+    }
 };
-std::mutex AverageTimerManager::collectedAverageTimesMapMutex;
-std::map<std::string, std::vector<profilerClock::duration>> AverageTimerManager::collectedAverageTimesMap;
 
-std::mutex AverageTimerManager::collectedCumulativeTimesMapMutex;
-std::map<std::string, std::vector<profilerClock::duration>> AverageTimerManager::collectedCumulativeTimesMap;
+// one scope in the breakdown of a single frame, times are inclusive of nested scopes
+struct FrameScopeTime {
+    std::string name;
+    std::uint64_t calls = 0;
+    ticks time = 0;
+};
 
-profilerClock::duration AverageTimerManager::profilerStartTime;
-bool AverageTimerManager::startTimeSet = false;
-bool AverageTimerManager::loggingEnabled = false;
+struct FrameBreakdown {
+    std::uint64_t frame = 0; // index of the frame, counted from the first mark
+    ticks duration = 0;
+    std::vector<FrameScopeTime> scopes; // longest first
+};
 
-void elapsed_time_colon_t_suffix(profilerClock::duration start) {
-    *defaultProfilerOutputStream
-            << "|| elapsed time: "
-            << std::chrono::duration<double>(profilerClock::now() - start).count() * profilerDurationScale
-            << getUnitSuffix(profilerDurationScale) << "\n";
-}
+struct FrameScopeStats {
+    std::string name;
+    std::uint64_t calls = 0;
+    RunningStats perFrame; // time per frame, over the frames the scope ran in
+};
 
-void id_colon_t_suffix_out_of_sleepduration(const std::string& id, profilerClock::duration t){
-    *defaultProfilerOutputStream
-        << std::setprecision(6)
-        << "|| " << id << ": "
-        << std::chrono::duration<double>(t).count() * profilerDurationScale
-        << getUnitSuffix(profilerDurationScale)
-        << " out of "
-        << defaultCumulativeTimerSleepDuration.count() / 1000000000LL * profilerDurationScale
-        << getUnitSuffix(profilerDurationScale) << "\n";
+// what one frame marker collected since the last report
+struct FrameReport {
+    RunningStats frames;
+    ticks budget = 0;
+    std::uint64_t overBudget = 0;
+    std::vector<FrameScopeStats> scopes;
+    std::vector<FrameBreakdown> worst; // longest first
+};
+
+enum class InstrumentKind : std::uint8_t {
+    counter,
+    gauge,
+    throughput
+};
+
+// what a running total in Metrics was collected from
+enum class StatKind : std::uint8_t {
+    average,
+    cumulative,
+    perf,
+    counter,
+    gauge,
+    throughput
+};
+
+inline constexpr const char* statKindNames[] = {"average", "cumulative", "perf", "counter", "gauge", "throughput"};
+
+// one counter, gauge or throughput timer over the interval since the last report
+struct InstrumentReading {
+    InstrumentKind kind = InstrumentKind::counter;
+    std::int64_t value = 0;    // counter total, latest gauge value, throughput items in the interval
+    std::int64_t delta = 0;    // counter: added in the interval
+    ticks time = 0;            // throughput: time spent timing the items
+    std::uint64_t updates = 0; // in the interval
+    ticks interval = 0;        // wall time the reading covers
+};
+
+// one cpu's part of an average timer over a report interval
+struct CpuShare {
+    std::uint32_t cpu = 0;
+    std::uint32_t node = 0;
+    std::uint64_t count = 0;
+    ticks sum = 0;
+};
+
+// what an empty probe costs, measured by Calibration::run() with the PF_CLOCK backend.
+// clock is the part inside every interval, the time between the two clock reads, the rest
+// is what one whole empty probe adds to a scope around it
+struct ProbeCosts {
+    ticks clock = 0;
+    ticks average = 0;
+    ticks cumulative = 0;
+    ticks histogram = 0;
+    ticks callTreeScope = 0;
+};
+
+// allocations are charged to the innermost active scope or average timer of the allocating
+// thread, through a thread local pointer and without locking. nothing is counted unless
+// PF_TRACK_ALLOCATIONS is defined before the header is included
+struct AllocationCounts {
+    std::uint64_t count = 0;
+    std::uint64_t bytes = 0;
+};
+
+inline thread_local AllocationCounts* currentAllocationScope = nullptr;
+
+inline void chargeAllocation(std::size_t size) noexcept {
+    if(AllocationCounts* c = currentAllocationScope) {
+        c->count++;
+        c->bytes += size;
+    }
 }
 
-class AverageTimer {
-    const char* id;
-    Timer t;
+class AllocationScope {
+#ifdef PF_TRACK_ALLOCATIONS
+    AllocationCounts counts;
+    AllocationCounts* previous = nullptr;
+#endif
 public:
-    AverageTimer(const char* _id) : id(_id) {
-        t.start();
+    void enter() {
+#ifdef PF_TRACK_ALLOCATIONS
+        previous = currentAllocationScope;
+        currentAllocationScope = &counts;
+#endif
     }
-    ~AverageTimer() {
-        AverageTimerManager::addAverageTime(id, t.stop());
+    AllocationCounts exit() {
+#ifdef PF_TRACK_ALLOCATIONS
+        currentAllocationScope = previous;
+        return counts;
+#else
+        return {};
+#endif
     }
 };
 
-class ScopeTimer {
-    const char* id;
-    Timer t;
+// charges nothing while it lives, for the bookkeeping and output a probe does around its scope,
+// which would otherwise land on the enclosing scope
+class UntrackedAllocations {
+#ifdef PF_TRACK_ALLOCATIONS
+    AllocationCounts* saved = currentAllocationScope;
+#endif
 public:
-    ScopeTimer(const char* _id) : id(_id) {
-        t.start();
+    UntrackedAllocations() {
+#ifdef PF_TRACK_ALLOCATIONS
+        currentAllocationScope = nullptr;
+#endif
     }
-    ~ScopeTimer() {
-        defaultProfilerOutputFunction(id, t.stop());
+    ~UntrackedAllocations() {
+#ifdef PF_TRACK_ALLOCATIONS
+        currentAllocationScope = saved;
+#endif
     }
+    UntrackedAllocations(const UntrackedAllocations&) = delete;
+    UntrackedAllocations& operator=(const UntrackedAllocations&) = delete;
 };
 
-class CumulativeTimer {
-    const char* id;
-    Timer t;
+enum class AggregationMode {
+    samples,   // keep every duration until the next log
+    streaming  // keep only RunningStats per id
+};
+
+inline AggregationMode profilerAggregationMode = AggregationMode::samples;
+
+using ProfilerOutputFunction = std::function<void(std::string_view, profilerClock::duration)>;
+using AverageTimerInfoOutputFunction = std::function<void(profilerClock::duration)>;
+using AverageTimerStatsOutputFunction = std::function<void(std::string_view, const RunningStats&)>;
+using HistogramOutputFunction = std::function<void(std::string_view, const Histogram&)>;
+using PerfOutputFunction = std::function<void(std::string_view, const PerfStats&)>;
+using PercentilesOutputFunction = std::function<void(std::string_view, const std::vector<std::pair<double, profilerClock::duration>>&)>;
+using FrameOutputFunction = std::function<void(std::string_view, const FrameReport&)>;
+using InstrumentOutputFunction = std::function<void(std::string_view, const InstrumentReading&)>;
+using AllocationOutputFunction = std::function<void(std::string_view, const AllocationCounts&, std::uint64_t)>;
+using CpuBreakdownOutputFunction = std::function<void(std::string_view, const std::vector<CpuShare>&)>;
+using ProbeOverheadOutputFunction = std::function<void(const ProbeCosts&)>;
+
+inline std::vector<double> defaultHistogramPercentiles = {50.0, 90.0, 99.0, 99.9};
+// exact percentiles of the raw average timer samples, none by default since selecting them copies every sample
+inline std::vector<double> defaultAverageTimerPercentiles;
+
+std::ostream* defaultProfilerOutputStream = &std::cout;
+
+// builds a line in a stack buffer and hands it to the stream in one write. numbers go through
+// to_chars with the stream's default 6 significant digits unless told otherwise, so nothing is
+// allocated or locale formatted and the stream's own formatting state is never touched
+class LineWriter {
+    std::ostream& out;
+    int digits;
+    std::size_t size = 0;
+    char text[256];
+
+    void spill() {
+        out.write(text, (std::streamsize)size);
+        size = 0;
+    }
 public:
-    CumulativeTimer(const char* _id) : id(_id) {
-        t.start();
+    explicit LineWriter(std::ostream& _out, int _digits = 6) : out(_out), digits(_digits) {}
+    ~LineWriter() {
+        spill();
     }
-    ~CumulativeTimer() {
-        AverageTimerManager::addCumulativeTime(id, t.stop());
+    LineWriter(const LineWriter&) = delete;
+    LineWriter& operator=(const LineWriter&) = delete;
+
+    LineWriter& operator<<(std::string_view s) {
+        if(size + s.size() > sizeof(text)) {
+            spill();
+            if(s.size() > sizeof(text)) {
+                out.write(s.data(), (std::streamsize)s.size());
+                return *this;
+            }
+        }
+        std::memcpy(text + size, s.data(), s.size());
+        size += s.size();
+        return *this;
+    }
+
+    template <typename IntT, typename = std::enable_if_t<std::is_integral_v<IntT> && !std::is_same_v<IntT, bool> && !std::is_same_v<IntT, char>>>
+    LineWriter& operator<<(IntT v) {
+        constexpr std::size_t longest = 24;
+        if(size + longest > sizeof(text)) spill();
+        size = std::to_chars(text + size, text + sizeof(text), v).ptr - text;
+        return *this;
+    }
+
+    LineWriter& operator<<(double v) {
+        constexpr std::size_t longest = 32;
+        if(size + longest > sizeof(text)) spill();
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+        size = std::to_chars(text + size, text + sizeof(text), v, std::chars_format::general, digits).ptr - text;
+#else
+        size += std::snprintf(text + size, longest, "%.*g", digits, v);
+#endif
+        return *this;
     }
 };
 
+void id_took_t_suffix(std::string_view id, profilerClock::duration t) {
+    LineWriter(*defaultProfilerOutputStream) << "|| " << id << " took " << scaledDuration(t) << profilerDurationSuffix << "\n";
 }
 
-#define CONCAT2(a, b) a##b
-#define CONCAT(a, b) CONCAT2(a, b)
+void id_colon_t_suffix(std::string_view id, profilerClock::duration t) {
+    LineWriter(*defaultProfilerOutputStream) << "|| " << id << ": " << scaledDuration(t) << profilerDurationSuffix << "\n";
+}
 
-#define PF_ENABLE_AVERAGE_TIMER_AUTO_LOG() profiler::AverageTimerManager::startAverageLoggingThread()
-#define PF_ENABLE_CUMULATIVE_TIMER_AUTO_LOG() profiler::AverageTimerManager::startCumulativeLoggingThread()
+void id_colon_t_suffix_out_of_sleepduration(std::string_view, profilerClock::duration);
 
-#define PF_SCOPE_TIMER(x) profiler::ScopeTimer CONCAT(scopetimer_, __LINE__)(x)
-#define PF_AVERAGE_TIMER(x) profiler::AverageTimer CONCAT(averagetimer_, __LINE__)(x)
-#define PF_CUMULATIVE_TIMER(x) profiler::CumulativeTimer CONCAT(cumulativetimer_, __LINE__)(x)
+void id_colon_percentiles_suffix(std::string_view id, const Histogram& h) {
+    std::string_view suffix = profilerDurationSuffix;
+    LineWriter line(*defaultProfilerOutputStream);
+    line << "|| " << id << ":";
+    for(double p : defaultHistogramPercentiles) line << " p" << p << " " << scaledDuration(h.percentile(p)) << suffix << ",";
+    line << " max " << scaledDuration(h.maximum()) << suffix << ", n " << h.count() << "\n";
+}
 
-#define PF_AVERAGE_TIMER_LOG() profiler::AverageTimerManager::averageLog()
-#define PF_CUMULATIVE_TIMER_LOG() profiler::AverageTimerManager::cumulativeLog()
+void id_colon_stats_suffix(std::string_view id, const RunningStats& stats) {
+    std::string_view suffix = profilerDurationSuffix;
+    LineWriter(*defaultProfilerOutputStream)
+        << "|| " << id << ": "
+        << "avg " << scaledDuration(stats.average()) << suffix
+        << ", min " << scaledDuration(stats.minimum()) << suffix
+        << ", max " << scaledDuration(stats.maximum()) << suffix
+        << ", stddev " << scaledDuration(stats.stddev()) << suffix
+        << ", n " << stats.count << "\n";
+}
 
-#define PF_SET_PROFILER_CLOCK(x) profiler::setProfilerClock<x>()
-#define PF_SET_PROFILER_DURATION_UNIT(x) profiler::setProfilerDurationScale<x>()
-#define PF_SET_OUTPUT_STREAM(x) profiler::defaultProfilerOutputStream = (x)
+void id_colon_perf_suffix(std::string_view id, const PerfStats& stats) {
+    LineWriter line(*defaultProfilerOutputStream);
+    line << "|| " << id << ": avg " << scaledDuration(stats.time.average()) << profilerDurationSuffix;
+    for(std::size_t i = 0; i < perfCounterCount; i++) {
+        if(!stats.counted(i)) continue;
+        line << ", " << perfCounterNames[i] << " " << stats.average(i);
+        if(i == 1 && stats.counted(0)) line << ", ipc " << stats.ipc();
+        if(i > 1 && stats.counted(1)) line << " (" << stats.perKiloInstruction(i) << " mpki)";
+    }
+    line << ", n " << stats.time.count << "\n";
+}
 
-#define PF_SET_OUTPUT_FUNCTION(x) profiler::defaultProfilerOutputFunction = (x)
-#define PF_SET_CUMULATIVE_TIMER_OUTPUT_FUNCTION(x) profiler::defaultCumulativeTimerOutputFunction = (x)
-#define PF_SET_AVERAGE_TIMER_INFO_OUTPUT_FUNCTION(x) profiler::defaultAverageTimerInfoOutputFunction = (x)
+void id_colon_exact_percentiles_suffix(std::string_view id, const std::vector<std::pair<double, profilerClock::duration>>& percentiles) {
+    LineWriter line(*defaultProfilerOutputStream);
+    line << "|| " << id << ":";
+    for(auto& [p, t] : percentiles) line << " p" << p << " " << scaledDuration(t) << profilerDurationSuffix << ",";
+    line << " exact\n";
+}
 
-#define PF_SET_AVERAGE_TIMER_SLEEP_DURATION(x) profiler::defaultAverageTimerSleepDuration = (x)
-#define PF_SET_CUMULATIVE_TIMER_SLEEP_DURATION(x) profiler::defaultCumulativeTimerSleepDuration = (x)
+void id_colon_frame_report(std::string_view id, const FrameReport& report) {
+    auto scaled = [](ticks t) { return scaledDuration(profilerClock::toDuration(t)); };
+    std::string_view suffix = profilerDurationSuffix;
+    double frames = (double)report.frames.count;
+    LineWriter line(*defaultProfilerOutputStream);
+    line << "|| frame " << id << ": avg " << scaled(report.frames.sum / (ticks)report.frames.count) << suffix
+         << ", min " << scaled(report.frames.min) << suffix
+         << ", max " << scaled(report.frames.max) << suffix
+         << ", n " << report.frames.count;
+    if(report.budget) line << ", " << report.overBudget << " over " << scaled(report.budget) << suffix;
+    line << "\n";
+    for(auto& scope : report.scopes) {
+        line << "||   " << scope.name << ": " << scaled(scope.perFrame.sum) / frames << suffix << " per frame"
+             << ", max " << scaled(scope.perFrame.max) << suffix
+             << ", " << (double)scope.calls / frames << " calls per frame\n";
+    }
+    for(auto& frame : report.worst) {
+        line << "|| worst frame " << id << " #" << frame.frame << ": " << scaled(frame.duration) << suffix << "\n";
+        for(auto& scope : frame.scopes) line << "||   " << scope.name << ": " << scaled(scope.time) << suffix << ", " << scope.calls << " calls\n";
+    }
+}
+
+// calls is the number of timed calls the allocations were charged over
+void id_colon_allocations_per_call(std::string_view id, const AllocationCounts& allocations, std::uint64_t calls) {
+    double n = calls ? double(calls) : 1.0;
+    LineWriter(*defaultProfilerOutputStream)
+        << "|| " << id << ": " << (double)allocations.count / n << " allocations, "
+        << (double)allocations.bytes / n << " bytes per call\n";
+}
+
+void id_colon_instrument(std::string_view id, const InstrumentReading& r) {
+    auto seconds = [](ticks t) { return std::chrono::duration<double>(profilerClock::toDuration(t)).count(); };
+    LineWriter line(*defaultProfilerOutputStream);
+    line << "|| " << id << ": ";
+    switch(r.kind) {
+    case InstrumentKind::counter:
+        line << r.value << " (+" << r.delta << ", " << (r.interval ? r.delta / seconds(r.interval) : 0.0) << "/s)\n";
+        break;
+    case InstrumentKind::gauge:
+        line << r.value << "\n";
+        break;
+    case InstrumentKind::throughput:
+        line << r.value << " items, " << (r.time ? r.value / seconds(r.time) : 0.0) << " items/s, "
+             << (r.value ? scaledDuration(profilerClock::toDuration(r.time)) / (double)r.value : 0.0)
+             << profilerDurationSuffix << "/item\n";
+        break;
+    }
+}
+
+// shares sorted by cpu, one line per node and one per cpu, with 3 digits
+void id_colon_cpu_breakdown(std::string_view id, const std::vector<CpuShare>& shares) {
+    auto scaled = [](ticks t) { return scaledDuration(profilerClock::toDuration(t)); };
+    std::string_view suffix = profilerDurationSuffix;
+    std::map<std::uint32_t, CpuShare> nodes;
+    std::uint64_t total = 0;
+    for(auto& share : shares) {
+        CpuShare& node = nodes[share.node];
+        node.node = share.node;
+        node.count += share.count;
+        node.sum += share.sum;
+        total += share.count;
+    }
+    LineWriter line(*defaultProfilerOutputStream, 3);
+    auto write = [&](const char* label, std::uint32_t n, const CpuShare& share, bool first) {
+        line << (first ? "" : ", ") << label << " " << n << " " << 100.0 * (double)share.count / (double)total << "%"
+             << " (" << share.count << ", avg " << scaled(share.sum / (ticks)share.count) << suffix << ")";
+    };
+    line << "|| " << id << " by node: ";
+    bool first = true;
+    for(auto& [n, share] : nodes) {
+        write("node", n, share, first);
+        first = false;
+    }
+    line << "\n|| " << id << " by cpu: ";
+    first = true;
+    for(auto& share : shares) {
+        write("cpu", share.cpu, share, first);
+        first = false;
+    }
+    line << "\n";
+}
+
+void probe_overhead_colon_costs(const ProbeCosts& c) {
+    auto scaled = [](ticks t) { return scaledDuration(profilerClock::toDuration(t)); };
+    std::string_view suffix = profilerDurationSuffix;
+    LineWriter(*defaultProfilerOutputStream)
+        << "|| probe overhead: clock " << scaled(c.clock) << suffix
+        << " per interval, average " << scaled(c.average) << suffix
+        << ", cumulative " << scaled(c.cumulative) << suffix
+        << ", histogram " << scaled(c.histogram) << suffix
+        << ", call tree scope " << scaled(c.callTreeScope) << suffix << " per call\n";
+}
+
+void elapsed_time_colon_t_suffix(profilerClock::duration);
+
+ProfilerOutputFunction defaultProfilerOutputFunction = id_took_t_suffix;
+ProfilerOutputFunction defaultCumulativeTimerOutputFunction = id_colon_t_suffix_out_of_sleepduration;
+HistogramOutputFunction defaultHistogramOutputFunction = id_colon_percentiles_suffix;
+PerfOutputFunction defaultPerfOutputFunction = id_colon_perf_suffix;
+AllocationOutputFunction defaultAllocationOutputFunction = id_colon_allocations_per_call;
+PercentilesOutputFunction defaultAverageTimerPercentilesOutputFunction = id_colon_exact_percentiles_suffix;
+FrameOutputFunction defaultFrameOutputFunction = id_colon_frame_report;
+InstrumentOutputFunction defaultInstrumentOutputFunction = id_colon_instrument;
+CpuBreakdownOutputFunction defaultCpuBreakdownOutputFunction = id_colon_cpu_breakdown;
+ProbeOverheadOutputFunction defaultProbeOverheadOutputFunction = probe_overhead_colon_costs;
+AverageTimerInfoOutputFunction defaultAverageTimerInfoOutputFunction = elapsed_time_colon_t_suffix;
+AverageTimerStatsOutputFunction defaultAverageTimerStatsOutputFunction = nullptr;
+
+profilerClock::duration defaultAverageTimerSleepDuration = std::chrono::seconds(1);
+profilerClock::duration defaultCumulativeTimerSleepDuration = std::chrono::seconds(1);
+profilerClock::duration defaultHistogramTimerSleepDuration = std::chrono::seconds(1);
+profilerClock::duration defaultPerfTimerSleepDuration = std::chrono::seconds(1);
+profilerClock::duration defaultMetricsSleepDuration = std::chrono::seconds(1);
+profilerClock::duration defaultFrameSleepDuration = std::chrono::seconds(1);
+profilerClock::duration defaultInstrumentSleepDuration = std::chrono::seconds(1);
+profilerClock::duration defaultSharedMemorySleepDuration = std::chrono::seconds(1);
+profilerClock::duration defaultSamplerSleepDuration = std::chrono::milliseconds(100);
+profilerClock::duration defaultSummarySleepDuration = std::chrono::seconds(10);
+profilerClock::duration defaultControlSleepDuration = std::chrono::seconds(1);
+// frames longer than this get their breakdown kept, zero keeps none
+profilerClock::duration defaultFrameBudget = profilerClock::duration::zero();
+
+// the calibrated costs, and whether timers take them off what they report. every duration then
+// loses the clock cost, and a call tree scope also loses the whole cost of the scopes below it.
+// the average, cumulative and histogram paths lock and insert after their last clock read, so
+// that part only shows up in scopes around them and is reported but not subtracted
+class ProbeOverhead {
+    static std::atomic<bool> subtractingCosts;
+    static std::atomic<ticks> clockCost;
+    static std::atomic<ticks> callTreeScopeCost;
+    static std::mutex costsMutex;
+    static std::optional<ProbeCosts> measured;
+public:
+    static bool subtracting() {
+        return subtractingCosts.load(std::memory_order_relaxed);
+    }
+
+    static void subtract(bool on = true) {
+        subtractingCosts.store(on, std::memory_order_relaxed);
+    }
+
+    // never below zero, a region cheaper than the median clock cost reports nothing
+    static ticks corrected(ticks elapsed) {
+        if(!subtracting()) return elapsed;
+        ticks d = elapsed - clockCost.load(std::memory_order_relaxed);
+        return d > 0 ? d : 0;
+    }
+
+    static ticks callTreeScope() {
+        return callTreeScopeCost.load(std::memory_order_relaxed);
+    }
+
+    static void set(const ProbeCosts& costs) {
+        std::lock_guard<std::mutex> lock(costsMutex);
+        measured = costs;
+        clockCost.store(costs.clock, std::memory_order_relaxed);
+        callTreeScopeCost.store(costs.callTreeScope, std::memory_order_relaxed);
+    }
+
+    static std::optional<ProbeCosts> costs() {
+        std::lock_guard<std::mutex> lock(costsMutex);
+        return measured;
+    }
+};
+std::atomic<bool> ProbeOverhead::subtractingCosts{false};
+std::atomic<ticks> ProbeOverhead::clockCost{0};
+std::atomic<ticks> ProbeOverhead::callTreeScopeCost{0};
+std::mutex ProbeOverhead::costsMutex;
+std::optional<ProbeCosts> ProbeOverhead::measured;
+
+class Timer {
+    profilerClock::ticks begin;
+public:
+    void start() {
+        begin = profilerClock::nowTicks();
+    }
+    profilerClock::ticks startedAt() const {
+        return begin;
+    }
+    profilerClock::ticks stopTicks() {
+        return ProbeOverhead::corrected(profilerClock::nowTicks() - begin);
+    }
+    profilerClock::duration stop() {
+        return profilerClock::toDuration(stopTicks());
+    }
+};
+
+using TimerId = std::uint32_t;
+inline constexpr TimerId invalidTimerId = std::numeric_limits<TimerId>::max();
+
+// what a PF_* call site keeps in its function-local static, name points at the registry's copy
+struct TimerHandle {
+    TimerId id = invalidTimerId;
+    const char* name = nullptr;
+};
+
+// only a name that is a const array, such as a literal, can be registered once per call site.
+// any other name may differ or dangle on the next call, so the site registers it every time
+template <typename NameT>
+inline constexpr bool stableName = std::is_array_v<std::remove_reference_t<NameT>>
+    && std::is_const_v<std::remove_extent_t<std::remove_reference_t<NameT>>>;
+
+// small sequential index of the calling thread, assigned on first use
+inline std::uint32_t currentThreadIndex() {
+    static std::atomic<std::uint32_t> nextIndex{0};
+    thread_local std::uint32_t index = nextIndex.fetch_add(1, std::memory_order_relaxed);
+    return index;
+}
+
+// the run time switches every probe checks with one relaxed load, scoped probes in their
+// constructor, async scopes when they start, profiled mutexes when they lock and frame marks
+// when they mark. a switched off probe does not read the clock. one byte per id holds the combined result of the global
+// switch and the name filter, so flipping the global switch rewrites the bytes of every id and
+// only touches atomics, which lets a signal handler do it. the filter is a comma separated list
+// of names, * matching any characters, and a leading - switching the match off. the last term
+// that matches a name decides, names no term matches stay on unless the list has a term without -
+class ProbeFilter {
+    static std::atomic<std::uint8_t> off[PF_MAX_FILTERED_IDS];       // what probes read
+    static std::atomic<std::uint8_t> filtered[PF_MAX_FILTERED_IDS];  // what the filter says
+    static std::atomic<std::uint8_t> pinned[PF_MAX_FILTERED_IDS];    // on whatever the switches say
+    static std::atomic<bool> globalOn;
+    static std::atomic<TimerId> known; // ids below it have their filter byte written
+    static std::mutex filterMutex;
+    static std::vector<std::string> terms;
+
+    static bool glob(std::string_view pattern, std::string_view name) {
+        std::size_t star = pattern.find('*');
+        if(star == std::string_view::npos) return pattern == name;
+        if(name.substr(0, star) != pattern.substr(0, star)) return false;
+        pattern.remove_prefix(star + 1);
+        name.remove_prefix(star);
+        for(std::size_t i = 0; i <= name.size(); i++) {
+            if(glob(pattern, name.substr(i))) return true;
+        }
+        return false;
+    }
+
+    // caller must hold filterMutex
+    static bool allowed(std::string_view name) {
+        bool result = true;
+        for(auto& t : terms) {
+            if(t[0] != '-') {
+                result = false;
+                break;
+            }
+        }
+        for(auto& t : terms) {
+            bool exclude = t[0] == '-';
+            if(glob(exclude ? std::string_view(t).substr(1) : std::string_view(t), name)) result = !exclude;
+        }
+        return result;
+    }
+
+    static void refresh(TimerId id) {
+        bool on = pinned[id].load(std::memory_order_relaxed) || (globalOn.load() && !filtered[id].load(std::memory_order_relaxed));
+        off[id].store(on ? 0 : 1, std::memory_order_relaxed);
+    }
+public:
+    static bool enabled(TimerId id) {
+        if(id < PF_MAX_FILTERED_IDS) return off[id].load(std::memory_order_relaxed) == 0;
+        return globalOn.load(std::memory_order_relaxed);
+    }
+
+    // for probes without an id
+    static bool enabled() {
+        return globalOn.load(std::memory_order_relaxed);
+    }
+
+    // async signal safe
+    static void enableAll(bool on = true) {
+        globalOn.store(on);
+        TimerId n = known.load();
+        for(TimerId id = 0; id < n; id++) refresh(id);
+    }
+
+    static void setTerms(std::string_view list) {
+        std::lock_guard<std::mutex> lock(filterMutex);
+        terms.clear();
+        while(!list.empty()) {
+            std::size_t comma = list.find(',');
+            std::string_view term = list.substr(0, comma);
+            while(!term.empty() && term.front() == ' ') term.remove_prefix(1);
+            while(!term.empty() && term.back() == ' ') term.remove_suffix(1);
+            if(!term.empty() && term != "-") terms.emplace_back(term);
+            list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+        }
+    }
+
+    // keeps a registered id on regardless of the global switch and the filter, for the probes
+    // the profiler runs on itself
+    static void pin(TimerId id, bool on = true) {
+        if(id >= PF_MAX_FILTERED_IDS) return;
+        pinned[id].store(on ? 1 : 0, std::memory_order_relaxed);
+        refresh(id);
+    }
+
+    // the filter byte of a new or renamed id, called by the registry
+    static void apply(TimerId id, std::string_view name) {
+        if(id >= PF_MAX_FILTERED_IDS) return;
+        {
+            std::lock_guard<std::mutex> lock(filterMutex);
+            filtered[id].store(allowed(name) ? 0 : 1, std::memory_order_relaxed);
+        }
+        TimerId n = known.load();
+        while(n <= id && !known.compare_exchange_weak(n, id + 1)) {}
+        refresh(id);
+    }
+};
+std::atomic<std::uint8_t> ProbeFilter::off[PF_MAX_FILTERED_IDS] = {};
+std::atomic<std::uint8_t> ProbeFilter::filtered[PF_MAX_FILTERED_IDS] = {};
+std::atomic<std::uint8_t> ProbeFilter::pinned[PF_MAX_FILTERED_IDS] = {};
+std::atomic<bool> ProbeFilter::globalOn{true};
+std::atomic<TimerId> ProbeFilter::known{0};
+std::mutex ProbeFilter::filterMutex;
+std::vector<std::string> ProbeFilter::terms;
+
+// resolves timer names to dense integer slots, names are registered once and never removed
+class TimerRegistry {
+    static std::mutex registryMutex;
+    static std::map<std::string, TimerId, std::less<>> ids;
+    static std::deque<std::string> names;
+    static std::deque<std::string_view> filterNames; // the part of each name the user wrote
+    static std::deque<std::string> keptNames; // kept names that are not timer names themselves
+public:
+    static TimerId registerTimer(std::string_view name) {
+        return registerTimer(name, {});
+    }
+
+    // the probe filter sees name without suffix, so "x (cumulative)" or "x wait" follow the
+    // filter terms for x
+    static TimerId registerTimer(std::string_view name, std::string_view suffix) {
+        UntrackedAllocations untracked;
+        std::string full;
+        if(!suffix.empty()) {
+            full.append(name).append(suffix);
+            name = full;
+        }
+        std::lock_guard<std::mutex> lock(registryMutex);
+        auto it = ids.find(name);
+        if(it != ids.end()) return it->second;
+        TimerId id = (TimerId)names.size();
+        names.emplace_back(name);
+        ids.emplace(names.back(), id);
+        filterNames.push_back(std::string_view(names.back()).substr(0, name.size() - suffix.size()));
+        ProbeFilter::apply(id, filterNames.back());
+        return id;
+    }
+
+    // runs every registered name through the current filter again
+    static void applyFilter() {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for(TimerId id = 0; id < names.size(); id++) ProbeFilter::apply(id, filterNames[id]);
+    }
+
+    static TimerId registerCumulativeTimer(std::string_view name) {
+        return registerTimer(name, " (cumulative)");
+    }
+
+    static const std::string& name(TimerId id) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        return names[id];
+    }
+
+    // a copy of name that lives as long as the registry, for handles that outlive the caller's string
+    static const char* keep(std::string_view name) {
+        UntrackedAllocations untracked;
+        std::lock_guard<std::mutex> lock(registryMutex);
+        auto it = ids.find(name);
+        if(it != ids.end()) return names[it->second].c_str();
+        return keptNames.emplace_back(name).c_str();
+    }
+
+    static std::size_t size() {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        return names.size();
+    }
+};
+std::mutex TimerRegistry::registryMutex;
+std::map<std::string, TimerId, std::less<>> TimerRegistry::ids;
+std::deque<std::string> TimerRegistry::names;
+std::deque<std::string_view> TimerRegistry::filterNames;
+std::deque<std::string> TimerRegistry::keptNames;
+
+constexpr std::size_t cacheLineSize = 64;
+
+struct alignas(cacheLineSize) SampleBlock {
+    static constexpr std::size_t capacity = (PF_SAMPLE_BLOCK_SIZE - 2 * sizeof(void*)) / sizeof(profilerClock::ticks);
+
+    SampleBlock* next = nullptr;
+    std::size_t size = 0;
+    profilerClock::ticks samples[capacity];
+
+    bool full() const { return size == capacity; }
+};
+
+// bump allocator for all profiler storage, so it neither fragments the application's heap nor
+// shows up in its allocation counts. memory is taken from the system in regions and never
+// handed back, sample blocks are recycled through a free list and container buffers through
+// one free list per power of two size, so a vector that grows leaves its old buffer for the
+// next one of that size. only sample blocks are refused past the cap, per-id slots and
+// histograms are bounded by the number of ids anyway
+class Arena {
+    struct FreeChunk {
+        FreeChunk* next;
+    };
+
+    static constexpr std::size_t minChunkSize = cacheLineSize;
+    static constexpr std::size_t chunkClasses = 40;
+
+    static std::mutex arenaMutex;
+    static char* cursor;
+    static char* regionEnd;
+    static std::size_t usedBytes;
+    static std::size_t capacityBytes;
+    static SampleBlock* freeBlocks;
+    static FreeChunk* freeChunks[chunkClasses];
+
+    static std::size_t chunkClass(std::size_t size) {
+        std::size_t c = 0;
+        while(c < chunkClasses && (minChunkSize << c) < size) c++;
+        return c;
+    }
+
+    // caller must hold arenaMutex
+    static void* bump(std::size_t size, std::size_t alignment) {
+        auto aligned = [&] { return reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(cursor) + alignment - 1) & ~(alignment - 1)); };
+        if(!cursor || aligned() + size > regionEnd) {
+            std::size_t regionSize = std::max<std::size_t>(PF_ARENA_REGION_SIZE, size + alignment);
+#if defined(__unix__) || defined(__APPLE__)
+            void* region = mmap(nullptr, regionSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(region == MAP_FAILED) throw std::bad_alloc();
+#else
+            void* region = std::malloc(regionSize);
+            if(!region) throw std::bad_alloc();
+#endif
+            cursor = static_cast<char*>(region);
+            regionEnd = cursor + regionSize;
+        }
+        char* p = aligned();
+        usedBytes += p + size - cursor;
+        cursor = p + size;
+        return p;
+    }
+public:
+    static void* allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t)) {
+        std::lock_guard<std::mutex> lock(arenaMutex);
+        return bump(size, alignment);
+    }
+
+    // container buffers, rounded up to their size class and aligned to a cache line
+    static void* allocateChunk(std::size_t size) {
+        std::size_t c = chunkClass(size);
+        if(c >= chunkClasses) throw std::bad_alloc();
+        std::lock_guard<std::mutex> lock(arenaMutex);
+        if(FreeChunk* chunk = freeChunks[c]) {
+            freeChunks[c] = chunk->next;
+            return chunk;
+        }
+        return bump(minChunkSize << c, cacheLineSize);
+    }
+
+    static void releaseChunk(void* p, std::size_t size) {
+        if(!p) return;
+        std::size_t c = chunkClass(size);
+        std::lock_guard<std::mutex> lock(arenaMutex);
+        freeChunks[c] = new(p) FreeChunk{freeChunks[c]};
+    }
+
+    // nullptr once the cap is reached and no freed block is left
+    static SampleBlock* acquireBlock() {
+        std::lock_guard<std::mutex> lock(arenaMutex);
+        if(SampleBlock* b = freeBlocks) {
+            freeBlocks = b->next;
+            b->next = nullptr;
+            b->size = 0;
+            return b;
+        }
+        if(usedBytes + sizeof(SampleBlock) > capacityBytes) return nullptr;
+        return new(bump(sizeof(SampleBlock), alignof(SampleBlock))) SampleBlock;
+    }
+
+    // gives back a chain of blocks linked through next
+    static void releaseBlocks(SampleBlock* first, SampleBlock* last) {
+        if(!first) return;
+        std::lock_guard<std::mutex> lock(arenaMutex);
+        last->next = freeBlocks;
+        freeBlocks = first;
+    }
+
+    static void setCapacity(std::size_t bytes) {
+        std::lock_guard<std::mutex> lock(arenaMutex);
+        capacityBytes = bytes;
+    }
+
+    static std::size_t used() {
+        std::lock_guard<std::mutex> lock(arenaMutex);
+        return usedBytes;
+    }
+};
+std::mutex Arena::arenaMutex;
+char* Arena::cursor = nullptr;
+char* Arena::regionEnd = nullptr;
+std::size_t Arena::usedBytes = 0;
+std::size_t Arena::capacityBytes = PF_ARENA_CAPACITY;
+SampleBlock* Arena::freeBlocks = nullptr;
+Arena::FreeChunk* Arena::freeChunks[Arena::chunkClasses] = {};
+
+// for containers owned by the profiler, freed buffers go back to the arena's size classes
+template <typename T>
+struct ArenaAllocator {
+    static_assert(alignof(T) <= cacheLineSize, "arena chunks are aligned to a cache line");
+    using value_type = T;
+
+    ArenaAllocator() = default;
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>&) {}
+
+    T* allocate(std::size_t n) {
+        if(n > std::numeric_limits<std::size_t>::max() / sizeof(T)) throw std::bad_alloc();
+        return static_cast<T*>(Arena::allocateChunk(n * sizeof(T)));
+    }
+    void deallocate(T* p, std::size_t n) { Arena::releaseChunk(p, n * sizeof(T)); }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>&) const { return false; }
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// raw samples live in a chain of arena blocks, once the arena is full they are folded into stats
+struct alignas(cacheLineSize) CollectedTimes {
+    RunningStats stats;
+    SampleBlock* first = nullptr;
+    SampleBlock* last = nullptr;
+    AllocationCounts allocations;
+
+    CollectedTimes() = default;
+    CollectedTimes(const CollectedTimes&) = delete;
+    CollectedTimes& operator=(const CollectedTimes&) = delete;
+    CollectedTimes(CollectedTimes&& other) noexcept
+        : stats(other.stats), first(other.first), last(other.last), allocations(other.allocations) {
+        other.first = other.last = nullptr;
+    }
+
+    void add(profilerClock::ticks t, std::uint32_t weight = 1, const AllocationCounts& a = {}) {
+        allocations.count += a.count * weight;
+        allocations.bytes += a.bytes * weight;
+        if(profilerAggregationMode == AggregationMode::streaming || weight != 1) {
+            stats.add(t, weight);
+            return;
+        }
+        if(!last || last->full()) {
+            SampleBlock* b = Arena::acquireBlock();
+            if(!b) {
+                stats.add(t);
+                return;
+            }
+            (last ? last->next : first) = b;
+            last = b;
+        }
+        last->samples[last->size++] = t;
+    }
+
+    // takes other's sample blocks and stats, leaving it empty
+    void splice(CollectedTimes& other) {
+        if(other.first) {
+            (last ? last->next : first) = other.first;
+            last = other.last;
+        }
+        stats.merge(other.stats);
+        allocations.count += other.allocations.count;
+        allocations.bytes += other.allocations.bytes;
+        other.first = other.last = nullptr;
+        other.stats = RunningStats();
+        other.allocations = AllocationCounts();
+    }
+
+    // the samples kept raw, not the ones folded into stats
+    template <typename F>
+    void forEachSample(F&& f) const {
+        for(const SampleBlock* b = first; b; b = b->next) {
+            for(std::size_t i = 0; i < b->size; i++) f(b->samples[i]);
+        }
+    }
+
+    RunningStats summarize() const {
+        RunningStats result;
+        for(const SampleBlock* b = first; b; b = b->next) result.addSamples(b->samples, b->size);
+        result.merge(stats);
+        return result;
+    }
+
+    // exact percentiles of the raw samples, samples folded into stats are not part of them
+    std::vector<std::pair<double, profilerClock::duration>> percentiles(const std::vector<double>& ps) const {
+        std::vector<std::pair<double, profilerClock::duration>> result;
+        if(!first || ps.empty()) return result;
+        // report time scratch, kept on the heap so it never takes from the cap meant for samples
+        UntrackedAllocations untracked;
+        thread_local std::vector<profilerClock::ticks> scratch;
+        scratch.clear();
+        for(const SampleBlock* b = first; b; b = b->next) scratch.insert(scratch.end(), b->samples, b->samples + b->size);
+        std::vector<profilerClock::ticks> values = selectPercentiles(scratch.data(), scratch.data() + scratch.size(), ps);
+        for(std::size_t i = 0; i < ps.size(); i++) result.emplace_back(ps[i], profilerClock::toDuration(values[i]));
+        return result;
+    }
+
+    void clear() {
+        Arena::releaseBlocks(first, last);
+        first = last = nullptr;
+        stats = RunningStats();
+        allocations = AllocationCounts();
+    }
+};
+
+struct TimerSummary {
+    TimerId id;
+    RunningStats stats;
+    AllocationCounts allocations;
+    std::vector<std::pair<double, profilerClock::duration>> percentiles;
+};
+
+// one id's samples copied out under the producer lock, summarized once the lock is released
+struct CollectedTimesCopy {
+    TimerId id;
+    RunningStats folded; // the samples that were not kept raw
+    AllocationCounts allocations;
+    std::vector<profilerClock::ticks> samples;
+
+    // reorders samples
+    TimerSummary summarize(const std::vector<double>& ps = {}) {
+        TimerSummary s{id, {}, allocations, {}};
+        s.stats.addSamples(samples.data(), samples.size());
+        s.stats.merge(folded);
+        if(samples.empty() || ps.empty()) return s;
+        std::vector<profilerClock::ticks> values = selectPercentiles(samples.data(), samples.data() + samples.size(), ps);
+        for(std::size_t i = 0; i < ps.size(); i++) s.percentiles.emplace_back(ps[i], profilerClock::toDuration(values[i]));
+        return s;
+    }
+};
+
+// dense per-id storage, indexed by TimerId
+class CollectedTimesSlots {
+    ArenaVector<CollectedTimes> slots;
+public:
+    CollectedTimes& operator[](TimerId id) {
+        if(id >= slots.size()) slots.resize(id + 1);
+        return slots[id];
+    }
+    std::size_t size() const { return slots.size(); }
+    const CollectedTimes* find(TimerId id) const {
+        return id < slots.size() ? &slots[id] : nullptr;
+    }
+    // a plain copy of every id that collected anything, far cheaper than summarizing in place
+    std::vector<CollectedTimesCopy> copy() const {
+        std::vector<CollectedTimesCopy> result;
+        for(TimerId id = 0; id < slots.size(); id++) {
+            const CollectedTimes& c = slots[id];
+            if(!c.first && c.stats.count == 0) continue;
+            CollectedTimesCopy& r = result.emplace_back(CollectedTimesCopy{id, c.stats, c.allocations, {}});
+            for(const SampleBlock* b = c.first; b; b = b->next) r.samples.insert(r.samples.end(), b->samples, b->samples + b->size);
+        }
+        return result;
+    }
+    // summaries of the ids that collected anything
+    std::vector<TimerSummary> summarize(const std::vector<double>& percentiles = {}) const {
+        std::vector<TimerSummary> result;
+        for(TimerId id = 0; id < slots.size(); id++) {
+            RunningStats stats = slots[id].summarize();
+            if(stats.count != 0) result.push_back({id, stats, slots[id].allocations, slots[id].percentiles(percentiles)});
+        }
+        return result;
+    }
+    // sample blocks go back to the arena for the next buffer to reuse
+    void clear() {
+        for(auto& c : slots) c.clear();
+    }
+    void swap(CollectedTimesSlots& other) { slots.swap(other.slots); }
+};
+
+// histograms are allocated in the arena once per id, recording never allocates
+class HistogramSlots {
+    ArenaVector<Histogram*> slots;
+public:
+    Histogram& operator[](TimerId id) {
+        if(id >= slots.size()) slots.resize(id + 1, nullptr);
+        if(!slots[id]) slots[id] = new(Arena::allocate(sizeof(Histogram), alignof(Histogram))) Histogram;
+        return *slots[id];
+    }
+    std::size_t size() const { return slots.size(); }
+    const Histogram* find(TimerId id) const {
+        return id < slots.size() ? slots[id] : nullptr;
+    }
+    // copies of the histograms that recorded anything
+    std::vector<std::pair<TimerId, Histogram>> snapshot() const {
+        std::vector<std::pair<TimerId, Histogram>> result;
+        for(TimerId id = 0; id < slots.size(); id++) {
+            if(slots[id] && slots[id]->count() != 0) result.emplace_back(id, *slots[id]);
+        }
+        return result;
+    }
+    void clear() {
+        for(auto& h : slots) if(h) h->clear();
+    }
+    void swap(HistogramSlots& other) { slots.swap(other.slots); }
+};
+
+class PerfSlots {
+    ArenaVector<PerfStats> slots;
+public:
+    PerfStats& operator[](TimerId id) {
+        if(id >= slots.size()) slots.resize(id + 1);
+        return slots[id];
+    }
+    std::vector<std::pair<TimerId, PerfStats>> snapshot() const {
+        std::vector<std::pair<TimerId, PerfStats>> result;
+        for(TimerId id = 0; id < slots.size(); id++) {
+            if(slots[id].time.count != 0) result.emplace_back(id, slots[id]);
+        }
+        return result;
+    }
+    void clear() {
+        for(auto& p : slots) p = PerfStats();
+    }
+    void swap(PerfSlots& other) { slots.swap(other.slots); }
+};
+
+template <typename T, std::size_t capacity>
+class SpscRing {
+    static_assert(capacity != 0 && (capacity & (capacity - 1)) == 0, "SpscRing capacity must be a power of two");
+    alignas(64) std::atomic<std::size_t> head{0}; // written by the producer
+    alignas(64) std::atomic<std::size_t> tail{0}; // written by the consumer
+    T buffer[capacity];
+public:
+    bool push(const T& value) {
+        std::size_t h = head.load(std::memory_order_relaxed);
+        if(h - tail.load(std::memory_order_acquire) == capacity) return false;
+        buffer[h & (capacity - 1)] = value;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    template <typename F>
+    std::size_t drain(F&& f) {
+        std::size_t t = tail.load(std::memory_order_relaxed);
+        std::size_t h = head.load(std::memory_order_acquire);
+        std::size_t n = h - t;
+        for(; t != h; ++t) f(buffer[t & (capacity - 1)]);
+        tail.store(t, std::memory_order_release);
+        return n;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+};
+
+struct TimerSample {
+    TimerId id;
+    std::uint32_t weight;
+    profilerClock::ticks t;
+#ifdef PF_TRACK_ALLOCATIONS
+    AllocationCounts allocations = {};
+#endif
+};
+
+// one BufferT per thread, owned jointly by the thread and the registry so data
+// pushed right before a thread exits is still drained. BufferT needs a
+// std::atomic<bool> retired member and an empty() method
+template <typename BufferT>
+class ThreadLocalBuffers {
+    static std::mutex buffersMutex;
+    static std::vector<std::shared_ptr<BufferT>> buffers;
+
+    struct Handle {
+        std::shared_ptr<BufferT> buffer = std::make_shared<BufferT>();
+        Handle() {
+            std::lock_guard<std::mutex> lock(buffersMutex);
+            buffers.push_back(buffer);
+        }
+        ~Handle() {
+            buffer->retired.store(true, std::memory_order_release);
+        }
+    };
+public:
+    static BufferT& local() {
+        thread_local Handle handle;
+        return *handle.buffer;
+    }
+
+    // buffers of exited threads are released once f has left them empty
+    template <typename F>
+    static void forEach(F&& f) {
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        for(auto it = buffers.begin(); it != buffers.end();) {
+            BufferT& b = **it;
+            bool retired = b.retired.load(std::memory_order_acquire);
+            f(b);
+            if(retired && b.empty()) it = buffers.erase(it);
+            else ++it;
+        }
+    }
+};
+template <typename BufferT>
+std::mutex ThreadLocalBuffers<BufferT>::buffersMutex;
+template <typename BufferT>
+std::vector<std::shared_ptr<BufferT>> ThreadLocalBuffers<BufferT>::buffers;
+
+struct ThreadSampleBuffer {
+    SpscRing<TimerSample, PF_THREAD_BUFFER_CAPACITY> average;
+    SpscRing<TimerSample, PF_THREAD_BUFFER_CAPACITY> cumulative;
+    SpscRing<TimerSample, PF_THREAD_BUFFER_CAPACITY> histogram;
+    std::atomic<bool> retired{false};
+
+    bool empty() const {
+        return average.empty() && cumulative.empty() && histogram.empty();
+    }
+};
+
+// stats of the average, cumulative and histogram timers sharded by the cpu a sample was taken
+// on, instead of one set per thread. their number is bounded by the cpus however often thread
+// pools churn, and a shard is allocated by the first thread that records on its cpu so its
+// pages are first touched on that cpu's node. sched_getcpu reads the cpu from rseq on recent
+// glibc. threads can migrate between reading the cpu and recording, so each shard keeps a lock
+// that is uncontended in the common case. reports fold the shards into the global buffers
+class CpuShards {
+public:
+    struct ShareTotals {
+        std::uint64_t count = 0;
+        ticks sum = 0;
+    };
+
+    struct alignas(cacheLineSize) Shard {
+        std::mutex mutex;
+        CollectedTimesSlots average;
+        CollectedTimesSlots cumulative;
+        HistogramSlots histogram;
+        ArenaVector<ShareTotals> averageShares; // only with the breakdown enabled
+        std::uint32_t cpu = 0;
+        std::uint32_t node = 0;
+    };
+private:
+    static std::atomic<Shard*> shards[PF_MAX_CPUS];
+    static std::atomic<bool> breakdownEnabled;
+    static std::once_flag nodesRead;
+    static std::vector<std::uint32_t> cpuNodes;
+
+    // node of every cpu from /sys/devices/system/node/node<n>/cpulist, all on node 0 elsewhere
+    static void readNodes() {
+#ifdef __linux__
+        DIR* dir = opendir("/sys/devices/system/node");
+        if(!dir) return;
+        while(dirent* entry = readdir(dir)) {
+            unsigned node;
+            char extra;
+            if(std::sscanf(entry->d_name, "node%u%c", &node, &extra) != 1) continue;
+            std::ifstream file(std::string("/sys/devices/system/node/") + entry->d_name + "/cpulist");
+            std::string list;
+            std::getline(file, list);
+            std::istringstream ranges(list);
+            for(std::string range; std::getline(ranges, range, ',');) {
+                unsigned first = 0, last = 0;
+                int n = std::sscanf(range.c_str(), "%u-%u", &first, &last);
+                if(n < 1) continue;
+                if(n == 1) last = first;
+                if(last >= cpuNodes.size()) cpuNodes.resize(last + 1, 0);
+                for(unsigned cpu = first; cpu <= last; cpu++) cpuNodes[cpu] = node;
+            }
+        }
+        closedir(dir);
+#endif
+    }
+
+    static Shard& create(std::uint32_t cpu) {
+        std::call_once(nodesRead, readNodes);
+        Shard* shard = new Shard;
+        shard->cpu = cpu;
+        shard->node = cpu < cpuNodes.size() ? cpuNodes[cpu] : 0;
+        Shard* expected = nullptr;
+        if(!shards[cpu % PF_MAX_CPUS].compare_exchange_strong(expected, shard, std::memory_order_acq_rel)) {
+            delete shard;
+            return *expected;
+        }
+        return *shard;
+    }
+public:
+    static std::uint32_t currentCpu() {
+#ifdef __linux__
+        int cpu = sched_getcpu();
+        return cpu < 0 ? 0 : (std::uint32_t)cpu;
+#else
+        return 0;
+#endif
+    }
+
+    // the shard of the cpu the calling thread runs on, shards live until the process exits
+    static Shard& local() {
+        std::uint32_t cpu = currentCpu();
+        Shard* shard = shards[cpu % PF_MAX_CPUS].load(std::memory_order_acquire);
+        return shard ? *shard : create(cpu);
+    }
+
+    static void enableBreakdown(bool enabled = true) {
+        breakdownEnabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    static bool breakdown() {
+        return breakdownEnabled.load(std::memory_order_relaxed);
+    }
+
+    static void addAverage(TimerId id, ticks t, std::uint32_t weight, const AllocationCounts& allocations) {
+        Shard& shard = local();
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.average[id].add(t, weight, allocations);
+        if(!breakdown()) return;
+        if(id >= shard.averageShares.size()) shard.averageShares.resize(id + 1);
+        shard.averageShares[id].count += weight;
+        shard.averageShares[id].sum += t * (ticks)weight;
+    }
+
+    static void addCumulative(TimerId id, ticks t, std::uint32_t weight) {
+        Shard& shard = local();
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.cumulative[id].add(t, weight);
+    }
+
+    static void addHistogram(TimerId id, ticks t, std::uint32_t weight) {
+        Shard& shard = local();
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.histogram[id].record(t, weight);
+    }
+
+    // f(shard) for every allocated shard, with its lock held
+    template <typename F>
+    static void forEach(F&& f) {
+        for(auto& slot : shards) {
+            Shard* shard = slot.load(std::memory_order_acquire);
+            if(!shard) continue;
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            f(*shard);
+        }
+    }
+
+    // every average timer's shares since the last call, reduced from the cpus that shared a
+    // shard and sorted by cpu
+    static std::map<TimerId, std::vector<CpuShare>> takeAverageShares() {
+        std::map<TimerId, std::vector<CpuShare>> result;
+        forEach([&](Shard& shard) {
+            for(TimerId id = 0; id < shard.averageShares.size(); id++) {
+                ShareTotals& totals = shard.averageShares[id];
+                if(totals.count) result[id].push_back({shard.cpu, shard.node, totals.count, totals.sum});
+                totals = ShareTotals();
+            }
+        });
+        return result;
+    }
+};
+std::atomic<CpuShards::Shard*> CpuShards::shards[PF_MAX_CPUS] = {};
+std::atomic<bool> CpuShards::breakdownEnabled{false};
+std::once_flag CpuShards::nodesRead;
+std::vector<std::uint32_t> CpuShards::cpuNodes;
+
+// unbounded SPSC queue made of fixed-size chunks. the producer allocates a chunk every
+// chunkSize pushes, the consumer frees the chunks it has read completely
+template <typename T, std::size_t chunkSize>
+class SpscChunkQueue {
+    struct Chunk {
+        std::atomic<std::size_t> count{0};
+        std::atomic<Chunk*> next{nullptr};
+        T items[chunkSize];
+    };
+    Chunk* head; // written by the producer
+    Chunk* tail; // read by the consumer
+    std::size_t tailIndex = 0;
+public:
+    SpscChunkQueue() : head(new Chunk), tail(head) {}
+    SpscChunkQueue(const SpscChunkQueue&) = delete;
+    SpscChunkQueue& operator=(const SpscChunkQueue&) = delete;
+    ~SpscChunkQueue() {
+        while(tail) {
+            Chunk* next = tail->next.load(std::memory_order_relaxed);
+            delete tail;
+            tail = next;
+        }
+    }
+
+    void push(const T& value) {
+        std::size_t n = head->count.load(std::memory_order_relaxed);
+        if(n == chunkSize) {
+            Chunk* c = new Chunk;
+            head->next.store(c, std::memory_order_release);
+            head = c;
+            n = 0;
+        }
+        head->items[n] = value;
+        head->count.store(n + 1, std::memory_order_release);
+    }
+
+    template <typename F>
+    std::size_t drain(F&& f) {
+        std::size_t drained = 0;
+        while(true) {
+            std::size_t n = tail->count.load(std::memory_order_acquire);
+            for(; tailIndex < n; ++tailIndex, ++drained) f(tail->items[tailIndex]);
+            if(n < chunkSize) break;
+            Chunk* next = tail->next.load(std::memory_order_acquire);
+            if(!next) break;
+            delete tail;
+            tail = next;
+            tailIndex = 0;
+        }
+        return drained;
+    }
+
+    bool empty() const {
+        return tailIndex == tail->count.load(std::memory_order_acquire)
+            && tail->next.load(std::memory_order_acquire) == nullptr;
+    }
+};
+
+struct TraceEvent {
+    const char* id;
+    profilerClock::ticks begin;
+    profilerClock::ticks end;
+    std::uint64_t task = 0; // the logical task of an async scope, zero for scope timers
+};
+
+struct ThreadTraceBuffer {
+    SpscChunkQueue<TraceEvent, PF_TRACE_CHUNK_SIZE> events;
+    std::uint32_t threadIndex = currentThreadIndex();
+    std::atomic<bool> retired{false};
+
+    bool empty() const {
+        return events.empty();
+    }
+};
+
+inline void writeJsonString(std::ostream& out, std::string_view str) {
+    out << '"';
+    for(char c : str) {
+        switch(c) {
+            case '"': out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\n': out << "\\n"; break;
+            case '\t': out << "\\t"; break;
+            default:
+                if((unsigned char)c < 0x20) out << "\\u00" << std::hex << std::setw(2) << std::setfill('0') << (int)c << std::dec << std::setfill(' ');
+                else out << c;
+        }
+    }
+    out << '"';
+}
+
+// scope timers record one complete event per scope into a per-thread queue while tracing
+// is enabled, written out later in the chrome trace event format (chrome://tracing, ui.perfetto.dev)
+class Tracer {
+    struct CollectedTraceEvent {
+        TraceEvent event;
+        std::uint32_t threadIndex;
+    };
+
+    static std::atomic<bool> tracingEnabled;
+    static std::mutex collectedEventsMutex;
+    static std::vector<CollectedTraceEvent> collectedEvents;
+public:
+    static void enable(bool enabled = true) {
+        tracingEnabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    static bool enabled() {
+        return tracingEnabled.load(std::memory_order_relaxed);
+    }
+
+    static void record(const char* id, profilerClock::ticks begin, profilerClock::ticks end, std::uint64_t task = 0) {
+        ThreadLocalBuffers<ThreadTraceBuffer>::local().events.push({id, begin, end, task});
+    }
+
+    // moves everything recorded so far out of the per-thread queues
+    static void collect() {
+        std::lock_guard<std::mutex> lock(collectedEventsMutex);
+        ThreadLocalBuffers<ThreadTraceBuffer>::forEach([](ThreadTraceBuffer& b) {
+            b.events.drain([&](const TraceEvent& e) { collectedEvents.push_back({e, b.threadIndex}); });
+        });
+    }
+
+    static void writeChromeTrace(std::ostream& out) {
+        collect();
+        std::lock_guard<std::mutex> lock(collectedEventsMutex);
+        profilerClock::ticks origin = std::numeric_limits<profilerClock::ticks>::max();
+        for(auto& c : collectedEvents) origin = std::min(origin, c.event.begin);
+        auto micros = [](profilerClock::ticks t) { return std::chrono::duration<double, std::micro>(profilerClock::toDuration(t)).count(); };
+
+        out << std::setprecision(15) << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        bool first = true;
+        for(auto& c : collectedEvents) {
+            out << (first ? "\n" : ",\n") << "{\"name\":";
+            writeJsonString(out, c.event.id);
+            out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << c.threadIndex
+                << ",\"ts\":" << micros(c.event.begin - origin)
+                << ",\"dur\":" << micros(c.event.end - c.event.begin);
+            if(c.event.task) out << ",\"args\":{\"task\":" << c.event.task << "}";
+            out << "}";
+            first = false;
+        }
+
+        // the running slices of a task are chained by flow arrows, which shows where it resumed
+        std::vector<const CollectedTraceEvent*> slices;
+        for(auto& c : collectedEvents) if(c.event.task) slices.push_back(&c);
+        std::sort(slices.begin(), slices.end(), [](auto a, auto b) {
+            return a->event.task != b->event.task ? a->event.task < b->event.task : a->event.begin < b->event.begin;
+        });
+        for(std::size_t i = 1; i < slices.size(); i++) {
+            const CollectedTraceEvent& from = *slices[i - 1];
+            const CollectedTraceEvent& to = *slices[i];
+            if(from.event.task != to.event.task) continue;
+            out << ",\n{\"name\":\"resume\",\"cat\":\"task\",\"ph\":\"s\",\"id\":" << from.event.task
+                << ",\"pid\":1,\"tid\":" << from.threadIndex << ",\"ts\":" << micros(from.event.begin - origin) << "}"
+                << ",\n{\"name\":\"resume\",\"cat\":\"task\",\"ph\":\"f\",\"bp\":\"e\",\"id\":" << to.event.task
+                << ",\"pid\":1,\"tid\":" << to.threadIndex << ",\"ts\":" << micros(to.event.begin - origin) << "}";
+        }
+        out << "\n]}\n";
+        collectedEvents.clear();
+    }
+
+    static bool writeChromeTrace(const std::string& path) {
+        std::ofstream file(path);
+        if(!file) {
+            std::cerr << "could not open trace file " << path << "\n";
+            return false;
+        }
+        writeChromeTrace(file);
+        return (bool)file;
+    }
+};
+std::atomic<bool> Tracer::tracingEnabled{false};
+std::mutex Tracer::collectedEventsMutex;
+std::vector<Tracer::CollectedTraceEvent> Tracer::collectedEvents;
+
+// one thread serving every periodic report job, each at its own interval. jobs are
+// kept in a priority queue by due time and the thread sleeps on a condition variable
+// until the earliest one, so adding a job or stopping wakes it immediately
+class Reporter {
+    using clock = std::chrono::steady_clock;
+
+    struct Job {
+        std::string name;
+        std::function<profilerClock::duration()> interval;
+        std::function<void()> run;
+    };
+    using Due = std::pair<clock::time_point, std::size_t>;
+
+    static std::mutex reporterMutex;
+    static std::condition_variable wakeup;
+    static std::vector<Job> jobs;
+    static std::priority_queue<Due, std::vector<Due>, std::greater<Due>> schedule;
+    static std::thread thread;
+    static bool running;
+    static bool stopRequested;
+
+    static void loop() {
+        std::unique_lock<std::mutex> lock(reporterMutex);
+        while(!stopRequested) {
+            if(schedule.empty()) {
+                wakeup.wait(lock);
+                continue;
+            }
+            Due next = schedule.top();
+            if(clock::now() < next.first) {
+                wakeup.wait_until(lock, next.first);
+                continue;
+            }
+            schedule.pop();
+            Job job = jobs[next.second];
+            lock.unlock();
+            job.run();
+            lock.lock();
+            schedule.push({clock::now() + job.interval(), next.second});
+        }
+    }
+
+public:
+    // a job that already exists under the same name is left as is
+    static void addJob(const std::string& name, std::function<profilerClock::duration()> interval, std::function<void()> run) {
+        std::lock_guard<std::mutex> lock(reporterMutex);
+        for(auto& j : jobs) if(j.name == name) return;
+        schedule.push({clock::now() + interval(), jobs.size()});
+        jobs.push_back({name, std::move(interval), std::move(run)});
+        wakeup.notify_one();
+    }
+
+    static bool hasJob(std::string_view name) {
+        std::lock_guard<std::mutex> lock(reporterMutex);
+        for(auto& j : jobs) if(j.name == name) return true;
+        return false;
+    }
+
+    static void start() {
+        std::lock_guard<std::mutex> lock(reporterMutex);
+        if(running) return;
+        stopRequested = false;
+        thread = std::thread(loop);
+        running = true;
+    }
+
+    // runs every job once, on the calling thread
+    static void flush() {
+        std::vector<Job> snapshot;
+        {
+            std::lock_guard<std::mutex> lock(reporterMutex);
+            snapshot = jobs;
+        }
+        for(auto& j : snapshot) j.run();
+    }
+
+    static void stop(bool flushJobs = true) {
+        {
+            std::lock_guard<std::mutex> lock(reporterMutex);
+            if(!running) return;
+            stopRequested = true;
+            wakeup.notify_one();
+        }
+        thread.join();
+        {
+            std::lock_guard<std::mutex> lock(reporterMutex);
+            running = false;
+        }
+        if(flushJobs) flush();
+    }
+
+    // stops the thread and reports what is left before static destruction
+    struct Stopper {
+        ~Stopper() { Reporter::stop(); }
+    };
+    static Stopper stopper;
+};
+std::mutex Reporter::reporterMutex;
+std::condition_variable Reporter::wakeup;
+std::vector<Reporter::Job> Reporter::jobs;
+std::priority_queue<Reporter::Due, std::vector<Reporter::Due>, std::greater<Reporter::Due>> Reporter::schedule;
+std::thread Reporter::thread;
+bool Reporter::running = false;
+bool Reporter::stopRequested = false;
+
+// switches the probes at run time from the environment, a signal or a control file. at start
+// PF_PROFILE=0 switches every probe off, PF_PROFILE_FILTER sets the name filter of ProbeFilter
+// and PF_PROFILE_CONTROL names a control file to watch. each line of the file is a command:
+// "enable", "disable" or "filter <list>", an empty list clears the filter, # starts a comment.
+// the file is applied whenever its content changes
+class RuntimeControl {
+    static std::mutex controlMutex;
+    static std::string controlPath;
+    static std::string appliedContent;
+
+    static void toggle(int) {
+        ProbeFilter::enableAll(!ProbeFilter::enabled());
+    }
+
+    static void poll() {
+        std::string path;
+        {
+            std::lock_guard<std::mutex> lock(controlMutex);
+            path = controlPath;
+        }
+        std::ifstream file(path);
+        if(!file) return;
+        std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        {
+            std::lock_guard<std::mutex> lock(controlMutex);
+            if(content == appliedContent) return;
+            appliedContent = content;
+        }
+        std::istringstream lines(content);
+        for(std::string line; std::getline(lines, line);) {
+            if(!apply(line)) std::cerr << "unknown profiler control command: " << line << "\n";
+        }
+    }
+public:
+    static void enable(bool on = true) {
+        ProbeFilter::enableAll(on);
+    }
+
+    static bool enabled() {
+        return ProbeFilter::enabled();
+    }
+
+    static void setFilter(std::string_view list) {
+        ProbeFilter::setTerms(list);
+        TimerRegistry::applyFilter();
+    }
+
+    // one control file line, false when it is not a command
+    static bool apply(std::string_view command) {
+        command = command.substr(0, command.find('#'));
+        while(!command.empty() && std::isspace((unsigned char)command.front())) command.remove_prefix(1);
+        while(!command.empty() && std::isspace((unsigned char)command.back())) command.remove_suffix(1);
+        if(command.empty()) return true;
+        if(command == "enable") enable();
+        else if(command == "disable") enable(false);
+        else if(command == "filter") setFilter("");
+        else if(command.substr(0, 7) == "filter ") setFilter(command.substr(7));
+        else return false;
+        return true;
+    }
+
+    // polls path every defaultControlSleepDuration on the reporter thread
+    static void watch(const std::string& path) {
+        {
+            std::lock_guard<std::mutex> lock(controlMutex);
+            controlPath = path;
+            appliedContent.clear();
+        }
+        poll();
+        Reporter::addJob("control", [] { return defaultControlSleepDuration; }, poll);
+        Reporter::start();
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    // every delivery of signal flips the global switch, false when the handler cannot be installed
+    static bool toggleOnSignal(int signal = SIGUSR2) {
+        struct sigaction action{};
+        action.sa_handler = toggle;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        return sigaction(signal, &action, nullptr) == 0;
+    }
+#endif
+
+    static void readEnvironment() {
+        if(const char* profile = std::getenv("PF_PROFILE")) {
+            std::string_view v = profile;
+            if(v == "0" || v == "off" || v == "false") enable(false);
+        }
+        if(const char* filter = std::getenv("PF_PROFILE_FILTER")) setFilter(filter);
+        if(const char* control = std::getenv("PF_PROFILE_CONTROL")) watch(control);
+    }
+
+    struct Initializer {
+        Initializer() { RuntimeControl::readEnvironment(); }
+    };
+    static Initializer initializer;
+};
+std::mutex RuntimeControl::controlMutex;
+std::string RuntimeControl::controlPath;
+std::string RuntimeControl::appliedContent;
+RuntimeControl::Initializer RuntimeControl::initializer;
+
+// running totals for the metrics exporter. every report folds what it retired in here, so the
+// exported counters never reset and the profiled threads never see any of it. scrapes only read
+// the pre-rendered snapshot
+class Metrics {
+    struct Totals {
+        RunningStats stats;
+        AllocationCounts allocations;
+    };
+
+    static std::atomic<bool> metricsEnabled;
+    static std::atomic<bool> summaryEnabled;
+    static std::mutex metricsMutex;
+    static ArenaVector<Totals> averages;
+    static ArenaVector<Totals> cumulatives;
+    static HistogramSlots histograms;
+    static HistogramSlots averageHistograms; // raw average samples, only kept for the summary
+    static PerfSlots perf;
+    static ArenaVector<InstrumentReading> instruments; // value and time are running totals here
+    static std::shared_ptr<const std::string> snapshot;
+
+    // what the active buffers of kinds without a report job held at the last collect, shown on
+    // top of the totals and dropped once a report folds the same samples into them
+    static ArenaVector<Totals> pendingAverages;
+    static ArenaVector<Totals> pendingCumulatives;
+    static HistogramSlots pendingHistograms;
+    static HistogramSlots pendingAverageHistograms;
+    static PerfSlots pendingPerf;
+    static std::vector<std::pair<TimerId, InstrumentReading>> pendingInstruments;
+
+    // the totals with the pending data added, what every output reads
+    struct View {
+        std::vector<Totals> averages;
+        std::vector<Totals> cumulatives;
+        std::map<TimerId, Histogram> histograms;
+        std::map<TimerId, Histogram> averageHistograms;
+        std::map<TimerId, PerfStats> perf;
+        ArenaVector<InstrumentReading> instruments;
+    };
+
+    static void addTotals(ArenaVector<Totals>& into, const std::vector<TimerSummary>& summaries) {
+        for(auto& s : summaries) {
+            if(s.id >= into.size()) into.resize(s.id + 1);
+            into[s.id].stats.merge(s.stats);
+            into[s.id].allocations.count += s.allocations.count;
+            into[s.id].allocations.bytes += s.allocations.bytes;
+        }
+    }
+
+    static void addTotals(std::vector<Totals>& into, const ArenaVector<Totals>& from) {
+        if(into.size() < from.size()) into.resize(from.size());
+        for(TimerId id = 0; id < from.size(); id++) {
+            into[id].stats.merge(from[id].stats);
+            into[id].allocations.count += from[id].allocations.count;
+            into[id].allocations.bytes += from[id].allocations.bytes;
+        }
+    }
+
+    static void addHistograms(std::map<TimerId, Histogram>& into, const HistogramSlots& from) {
+        for(TimerId id = 0; id < from.size(); id++) {
+            const Histogram* h = from.find(id);
+            if(h && h->count() != 0) into[id].merge(*h);
+        }
+    }
+
+    static void addInstruments(ArenaVector<InstrumentReading>& into, const std::vector<std::pair<TimerId, InstrumentReading>>& readings) {
+        for(auto& [id, r] : readings) {
+            if(id >= into.size()) into.resize(id + 1);
+            InstrumentReading& total = into[id];
+            total.kind = r.kind;
+            total.updates += r.updates;
+            if(r.kind == InstrumentKind::throughput) {
+                total.value += r.value;
+                total.time += r.time;
+            }
+            else total.value = r.value;
+        }
+    }
+
+    // caller must hold metricsMutex
+    static View view() {
+        View v;
+        addTotals(v.averages, averages);
+        addTotals(v.averages, pendingAverages);
+        addTotals(v.cumulatives, cumulatives);
+        addTotals(v.cumulatives, pendingCumulatives);
+        addHistograms(v.histograms, histograms);
+        addHistograms(v.histograms, pendingHistograms);
+        addHistograms(v.averageHistograms, averageHistograms);
+        addHistograms(v.averageHistograms, pendingAverageHistograms);
+        for(auto& [id, p] : perf.snapshot()) v.perf[id].merge(p);
+        for(auto& [id, p] : pendingPerf.snapshot()) v.perf[id].merge(p);
+        v.instruments = instruments;
+        addInstruments(v.instruments, pendingInstruments);
+        return v;
+    }
+
+    static double seconds(profilerClock::ticks t) {
+        return std::chrono::duration<double>(profilerClock::toDuration(t)).count();
+    }
+
+    static void writeLabel(std::ostream& out, const std::string& name) {
+        out << "{name=\"";
+        for(char c : name) {
+            if(c == '\\' || c == '"') out << '\\' << c;
+            else if(c == '\n') out << "\\n";
+            else out << c;
+        }
+        out << "\"";
+    }
+
+    static void writeSample(std::ostream& out, const char* metric, const std::string& name, double value) {
+        out << metric;
+        writeLabel(out, name);
+        out << "} " << value << "\n";
+    }
+
+    // caller must hold metricsMutex
+    static std::string render() {
+        // a constant rather than a local static, which the exit flush could outlive
+        static constexpr double bucketBounds[] = {
+            1e-6, 2.5e-6, 5e-6, 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4,
+            1e-3, 2.5e-3, 5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0
+        };
+
+        View v = view();
+        std::ostringstream out;
+        out << std::setprecision(9);
+        out << "# TYPE profiler_average_timer_seconds summary\n# UNIT profiler_average_timer_seconds seconds\n";
+        for(TimerId id = 0; id < v.averages.size(); id++) {
+            if(v.averages[id].stats.count == 0) continue;
+            writeSample(out, "profiler_average_timer_seconds_count", TimerRegistry::name(id), (double)v.averages[id].stats.count);
+            writeSample(out, "profiler_average_timer_seconds_sum", TimerRegistry::name(id), seconds(v.averages[id].stats.sum));
+        }
+#ifdef PF_TRACK_ALLOCATIONS
+        out << "# TYPE profiler_average_timer_allocations counter\n";
+        for(TimerId id = 0; id < v.averages.size(); id++) {
+            if(v.averages[id].stats.count == 0) continue;
+            writeSample(out, "profiler_average_timer_allocations_total", TimerRegistry::name(id), (double)v.averages[id].allocations.count);
+        }
+        out << "# TYPE profiler_average_timer_allocated_bytes counter\n# UNIT profiler_average_timer_allocated_bytes bytes\n";
+        for(TimerId id = 0; id < v.averages.size(); id++) {
+            if(v.averages[id].stats.count == 0) continue;
+            writeSample(out, "profiler_average_timer_allocated_bytes_total", TimerRegistry::name(id), (double)v.averages[id].allocations.bytes);
+        }
+#endif
+        out << "# TYPE profiler_cumulative_timer_seconds counter\n# UNIT profiler_cumulative_timer_seconds seconds\n";
+        for(TimerId id = 0; id < v.cumulatives.size(); id++) {
+            if(v.cumulatives[id].stats.count == 0) continue;
+            writeSample(out, "profiler_cumulative_timer_seconds_total", TimerRegistry::name(id), seconds(v.cumulatives[id].stats.sum));
+        }
+        out << "# TYPE profiler_histogram_timer_seconds histogram\n# UNIT profiler_histogram_timer_seconds seconds\n";
+        for(auto& [id, histogram] : v.histograms) {
+            const Histogram* h = &histogram;
+            const std::string& name = TimerRegistry::name(id);
+            for(double bound : bucketBounds) {
+                profilerClock::ticks t = profilerClock::toTicks(std::chrono::duration_cast<profilerClock::duration>(std::chrono::duration<double>(bound)));
+                out << "profiler_histogram_timer_seconds_bucket";
+                writeLabel(out, name);
+                out << ",le=\"" << bound << "\"} " << h->countAtOrBelow(t) << "\n";
+            }
+            out << "profiler_histogram_timer_seconds_bucket";
+            writeLabel(out, name);
+            out << ",le=\"+Inf\"} " << h->count() << "\n";
+            writeSample(out, "profiler_histogram_timer_seconds_count", name, (double)h->count());
+            writeSample(out, "profiler_histogram_timer_seconds_sum", name, seconds(h->sum()));
+        }
+        const std::map<TimerId, PerfStats>& perfStats = v.perf;
+        out << "# TYPE profiler_perf_scope_seconds summary\n# UNIT profiler_perf_scope_seconds seconds\n";
+        for(auto& [id, p] : perfStats) {
+            writeSample(out, "profiler_perf_scope_seconds_count", TimerRegistry::name(id), (double)p.time.count);
+            writeSample(out, "profiler_perf_scope_seconds_sum", TimerRegistry::name(id), seconds(p.time.sum));
+        }
+        for(std::size_t i = 0; i < perfCounterCount; i++) {
+            std::string metric = std::string("profiler_perf_scope_") + perfCounterNames[i];
+            std::replace(metric.begin(), metric.end(), ' ', '_');
+            out << "# TYPE " << metric << " counter\n";
+            metric += "_total";
+            for(auto& [id, p] : perfStats) {
+                if(p.counted(i)) writeSample(out, metric.c_str(), TimerRegistry::name(id), (double)p.totals[i]);
+            }
+        }
+        const InstrumentKind kinds[] = {InstrumentKind::counter, InstrumentKind::gauge, InstrumentKind::throughput};
+        const char* types[] = {"# TYPE profiler_counter counter\n", "# TYPE profiler_gauge gauge\n",
+                               "# TYPE profiler_throughput_items counter\n"};
+        const char* metrics[] = {"profiler_counter_total", "profiler_gauge", "profiler_throughput_items_total"};
+        for(std::size_t k = 0; k < 3; k++) {
+            out << types[k];
+            for(TimerId id = 0; id < v.instruments.size(); id++) {
+                const InstrumentReading& r = v.instruments[id];
+                if(r.updates && r.kind == kinds[k]) writeSample(out, metrics[k], TimerRegistry::name(id), (double)r.value);
+            }
+        }
+        out << "# TYPE profiler_throughput_seconds counter\n# UNIT profiler_throughput_seconds seconds\n";
+        for(TimerId id = 0; id < v.instruments.size(); id++) {
+            const InstrumentReading& r = v.instruments[id];
+            if(r.updates && r.kind == InstrumentKind::throughput) writeSample(out, "profiler_throughput_seconds_total", TimerRegistry::name(id), seconds(r.time));
+        }
+        out << "# EOF\n";
+        return out.str();
+    }
+public:
+    static void enable(bool enabled = true) {
+        metricsEnabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    static bool enabled() {
+        return metricsEnabled.load(std::memory_order_relaxed);
+    }
+
+    static void addAverages(const std::vector<TimerSummary>& summaries) {
+        std::lock_guard<std::mutex> lock(metricsMutex);
+        addTotals(averages, summaries);
+        pendingAverages.clear();
+        pendingAverageHistograms.clear();
+    }
+
+    // the summary also keeps a histogram of every raw average sample, for its percentiles
+    static void enableSummary() {
+        summaryEnabled.store(true, std::memory_order_relaxed);
+        enable();
+    }
+
+    static bool summarizing() {
+        return summaryEnabled.load(std::memory_order_relaxed);
+    }
+
+    static void addAverageSamples(const CollectedTimesSlots& retired) {
+        std::lock_guard<std::mutex> lock(metricsMutex);
+        for(TimerId id = 0; id < retired.size(); id++) {
+            const CollectedTimes* c = retired.find(id);
+            if(!c || !c->first) continue;
+            Histogram& h = averageHistograms[id];
+            c->forEachSample([&](profilerClock::ticks t) { h.record(t); });
+        }
+    }
+
+    static void addCumulatives(const std::vector<TimerSummary>& summaries) {
+        std::lock_guard<std::mutex> lock(metricsMutex);
+        addTotals(cumulatives, summaries);
+        pendingCumulatives.clear();
+    }
+
+    static void addHistograms(const HistogramSlots& retired) {
+        std::lock_guard<std::mutex> lock(metricsMutex);
+        for(TimerId id = 0; id < retired.size(); id++) {
+            const Histogram* h = retired.find(id);
+            if(h && h->count() != 0) histograms[id].merge(*h);
+        }
+        pendingHistograms.clear();
+    }
+
+    static void addPerf(const std::vector<std::pair<TimerId, PerfStats>>& stats) {
+        std::lock_guard<std::mutex> lock(metricsMutex);
+        for(auto& [id, p] : stats) perf[id].merge(p);
+        pendingPerf.clear();
+    }
+
+    static void addInstruments(const std::vector<std::pair<TimerId, InstrumentReading>>& readings) {
+        std::lock_guard<std::mutex> lock(metricsMutex);
+        addInstruments(instruments, readings);
+        pendingInstruments.clear();
+    }
+
+    // the set* calls replace the pending data of one kind with a fresh copy of its active buffers
+    static void setPendingAverages(std::vector<CollectedTimesCopy>& copies) {
+        std::lock_guard<std::mutex> lock(metricsMutex);
+        pendingAverages.clear();
+        pendingAverageHistograms.clear();
+        for(auto& c : copies) {
+            if(summarizing()) for(profilerClock::ticks t : c.samples) pendingAverageHistograms[c.id].record(t);
+            addTotals(pendingAverages, {c.summarize()});
+        }
+    }
+
+    static void setPendingCumulatives(std::vector<CollectedTimesCopy>& copies) {
+        std::lock_guard<std::mutex> lock(metricsMutex);
+        pendingCumulatives.clear();
+        for(auto& c : copies) addTotals(pendingCumulatives, {c.summarize()});
+    }
+
+    static void setPendingHistograms(const std::vector<std::pair<TimerId, Histogram>>& active) {
+        std::lock_guard<std::mutex> lock(metricsMutex);
+        pendingHistograms.clear();
+        for(auto& [id, h] : active) pendingHistograms[id].merge(h);
+    }
+
+    static void setPendingPerf(const std::vector<std::pair<TimerId, PerfStats>>& active) {
+        std::lock_guard<std::mutex> lock(metricsMutex);
+        pendingPerf.clear();
+        for(auto& [id, p] : active) pendingPerf[id].merge(p);
+    }
+
+    static void setPendingInstruments(const std::vector<std::pair<TimerId, InstrumentReading>>& readings) {
+        std::lock_guard<std::mutex> lock(metricsMutex);
+        pendingInstruments = readings;
+    }
+
+    // calls f(kind, id, count, time, value) for every running total, under the metrics lock.
+    // time is the summed duration in ticks, value the counter total, gauge or throughput items
+    template <typename F>
+    static void forEachTotal(F&& f) {
+        std::lock_guard<std::mutex> lock(metricsMutex);
+        View v = view();
+        for(TimerId id = 0; id < v.averages.size(); id++) {
+            if(v.averages[id].stats.count) f(StatKind::average, id, v.averages[id].stats.count, v.averages[id].stats.sum, (std::int64_t)0);
+        }
+        for(TimerId id = 0; id < v.cumulatives.size(); id++) {
+            if(v.cumulatives[id].stats.count) f(StatKind::cumulative, id, v.cumulatives[id].stats.count, v.cumulatives[id].stats.sum, (std::int64_t)0);
+        }
+        for(auto& [id, p] : v.perf) f(StatKind::perf, id, p.time.count, p.time.sum, (std::int64_t)0);
+        const StatKind instrumentKinds[] = {StatKind::counter, StatKind::gauge, StatKind::throughput};
+        for(TimerId id = 0; id < v.instruments.size(); id++) {
+            const InstrumentReading& r = v.instruments[id];
+            if(r.updates) f(instrumentKinds[(std::size_t)r.kind], id, r.updates, r.time, r.value);
+        }
+    }
+
+    // every running total as the json profiler-diff compares, in nanoseconds. percentiles come
+    // from the histograms. an average timer only gets them when every one of its calls was kept
+    // raw, samples folded into stats by streaming mode, the arena cap or a sampled site carry no
+    // value to rank, and leaving them out would bias the p99 profiler-diff gates on
+    static void writeSummary(std::ostream& out) {
+        std::lock_guard<std::mutex> lock(metricsMutex);
+        auto ns = [](double t) {
+            return std::chrono::duration<double, std::nano>(profilerClock::toDuration((profilerClock::ticks)std::llround(t))).count();
+        };
+        // variance is in squared ticks, so it scales with the square of a tick
+        double nsPerTick = ns(1e6) / 1e6;
+        bool first = true;
+        auto entry = [&](const char* kind, TimerId id, const RunningStats* stats, const Histogram* h) {
+            out << (first ? "\n" : ",\n") << "{\"kind\":\"" << kind << "\",\"name\":";
+            writeJsonString(out, TimerRegistry::name(id));
+            if(stats) {
+                out << ",\"count\":" << stats->count << ",\"mean_ns\":" << stats->mean * nsPerTick
+                    << ",\"variance_ns2\":" << stats->variance() * nsPerTick * nsPerTick
+                    << ",\"min_ns\":" << ns((double)stats->min) << ",\"max_ns\":" << ns((double)stats->max);
+            }
+            else out << ",\"count\":" << h->count();
+            if(h && h->count()) {
+                out << ",\"p50_ns\":" << std::chrono::duration<double, std::nano>(h->percentile(50)).count()
+                    << ",\"p99_ns\":" << std::chrono::duration<double, std::nano>(h->percentile(99)).count();
+            }
+            out << "}";
+            first = false;
+        };
+        View v = view();
+        auto samples = [&](TimerId id) -> const Histogram* {
+            auto it = v.averageHistograms.find(id);
+            if(it == v.averageHistograms.end() || it->second.count() != v.averages[id].stats.count) return nullptr;
+            return &it->second;
+        };
+        out << std::setprecision(12) << "{\"format\":\"profiler summary\",\"version\":1,\"timers\":[";
+        for(TimerId id = 0; id < v.averages.size(); id++) {
+            if(v.averages[id].stats.count) entry("average", id, &v.averages[id].stats, samples(id));
+        }
+        for(TimerId id = 0; id < v.cumulatives.size(); id++) {
+            if(v.cumulatives[id].stats.count) entry("cumulative", id, &v.cumulatives[id].stats, nullptr);
+        }
+        for(auto& [id, h] : v.histograms) entry("histogram", id, nullptr, &h);
+        for(auto& [id, p] : v.perf) entry("perf", id, &p.time, nullptr);
+        out << "\n]}\n";
+    }
+
+    // renders the totals into the snapshot that scrapes read
+    static void publish() {
+        std::shared_ptr<const std::string> text;
+        {
+            std::lock_guard<std::mutex> lock(metricsMutex);
+            text = std::make_shared<const std::string>(render());
+        }
+        std::atomic_store(&snapshot, text);
+    }
+
+    // the last published snapshot, never null
+    static std::shared_ptr<const std::string> current() {
+        std::shared_ptr<const std::string> text = std::atomic_load(&snapshot);
+        return text ? text : std::make_shared<const std::string>("# EOF\n");
+    }
+};
+std::atomic<bool> Metrics::metricsEnabled{false};
+std::atomic<bool> Metrics::summaryEnabled{false};
+std::mutex Metrics::metricsMutex;
+ArenaVector<Metrics::Totals> Metrics::averages;
+ArenaVector<Metrics::Totals> Metrics::cumulatives;
+HistogramSlots Metrics::histograms;
+HistogramSlots Metrics::averageHistograms;
+PerfSlots Metrics::perf;
+ArenaVector<InstrumentReading> Metrics::instruments;
+std::shared_ptr<const std::string> Metrics::snapshot;
+ArenaVector<Metrics::Totals> Metrics::pendingAverages;
+ArenaVector<Metrics::Totals> Metrics::pendingCumulatives;
+HistogramSlots Metrics::pendingHistograms;
+HistogramSlots Metrics::pendingAverageHistograms;
+PerfSlots Metrics::pendingPerf;
+std::vector<std::pair<TimerId, InstrumentReading>> Metrics::pendingInstruments;
+
+// every kind is double buffered: producers only ever touch the active buffer under its mutex,
+// a report swaps in the spare one and formats the retired buffer with no producer lock held.
+// the report mutex serializes reports and guards the spare buffer
+class AverageTimerManager {
+    static std::mutex collectedAverageTimesMutex;
+    static CollectedTimesSlots collectedAverageTimes;
+    static std::mutex averageReportMutex;
+    static CollectedTimesSlots retiredAverageTimes;
+
+    static std::mutex collectedCumulativeTimesMutex;
+    static CollectedTimesSlots collectedCumulativeTimes;
+    static std::mutex cumulativeReportMutex;
+    static CollectedTimesSlots retiredCumulativeTimes;
+
+    static std::mutex collectedHistogramsMutex;
+    static HistogramSlots collectedHistograms;
+    static std::mutex histogramReportMutex;
+    static HistogramSlots retiredHistograms;
+
+    // perf scopes always take the lock, reading the counters costs more than the lock already
+    static std::mutex collectedPerfMutex;
+    static PerfSlots collectedPerf;
+    static std::mutex perfReportMutex;
+    static PerfSlots retiredPerf;
+
+    static profilerClock::duration profilerStartTime;
+    static bool startTimeSet;
+
+    static std::atomic<bool> threadLocalBuffersEnabled;
+    static std::atomic<bool> cpuShardsEnabled;
+
+#ifdef PF_TRACK_ALLOCATIONS
+    static void addSample(CollectedTimes& c, const TimerSample& s) { c.add(s.t, s.weight, s.allocations); }
+#else
+    static void addSample(CollectedTimes& c, const TimerSample& s) { c.add(s.t, s.weight); }
+#endif
+    static void addSample(Histogram& h, const TimerSample& s) { h.record(s.t, s.weight); }
+
+    // caller must hold the mutex of the slots the ring is drained into
+    template <typename RingT, typename SlotsT>
+    static void drainThreadSampleBuffers(RingT ThreadSampleBuffer::*ring, SlotsT& into) {
+        ThreadLocalBuffers<ThreadSampleBuffer>::forEach([&](ThreadSampleBuffer& b) {
+            (b.*ring).drain([&](const TimerSample& s) { addSample(into[s.id], s); });
+        });
+    }
+
+    static void mergeShard(CollectedTimes& into, CollectedTimes& from) { into.splice(from); }
+    static void mergeShard(Histogram& into, Histogram& from) {
+        into.merge(from);
+        from.clear();
+    }
+
+    // caller must hold the mutex of into, the cpu shards are taken one after another
+    template <typename SlotsT>
+    static void drainCpuShards(SlotsT CpuShards::Shard::*slots, SlotsT& into) {
+        CpuShards::forEach([&](CpuShards::Shard& shard) {
+            SlotsT& from = shard.*slots;
+            for(TimerId id = 0; id < from.size(); id++) {
+                if(from.find(id)) mergeShard(into[id], from[id]);
+            }
+        });
+    }
+
+    static void drainAverageSamples() {
+        drainThreadSampleBuffers(&ThreadSampleBuffer::average, collectedAverageTimes);
+        drainCpuShards(&CpuShards::Shard::average, collectedAverageTimes);
+    }
+
+    static void drainHistogramSamples() {
+        drainThreadSampleBuffers(&ThreadSampleBuffer::histogram, collectedHistograms);
+        drainCpuShards(&CpuShards::Shard::histogram, collectedHistograms);
+    }
+
+    static void addSharedHistogramTime(TimerId id, profilerClock::ticks t, std::uint32_t weight) {
+        if(cpuShardsEnabled.load(std::memory_order_relaxed)) {
+            CpuShards::addHistogram(id, t, weight);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(collectedHistogramsMutex);
+        collectedHistograms[id].record(t, weight);
+    }
+
+    static void drainCumulativeSamples() {
+        drainThreadSampleBuffers(&ThreadSampleBuffer::cumulative, collectedCumulativeTimes);
+        drainCpuShards(&CpuShards::Shard::cumulative, collectedCumulativeTimes);
+    }
+
+    static void writeAverage(const TimerSummary& s) {
+        defaultAverageTimerInfoOutputFunction(profilerStartTime);
+        if(defaultAverageTimerStatsOutputFunction) defaultAverageTimerStatsOutputFunction(TimerRegistry::name(s.id), s.stats);
+        else defaultProfilerOutputFunction(TimerRegistry::name(s.id), s.stats.average());
+        if(!s.percentiles.empty()) defaultAverageTimerPercentilesOutputFunction(TimerRegistry::name(s.id), s.percentiles);
+#ifdef PF_TRACK_ALLOCATIONS
+        defaultAllocationOutputFunction(TimerRegistry::name(s.id), s.allocations, s.stats.count);
+#endif
+    }
+
+    static void writeCumulative(const TimerSummary& s) {
+        defaultAverageTimerInfoOutputFunction(profilerStartTime);
+        defaultCumulativeTimerOutputFunction(TimerRegistry::name(s.id), s.stats.total());
+    }
+
+    static void writeHistogram(TimerId id, const Histogram& h) {
+        defaultAverageTimerInfoOutputFunction(profilerStartTime);
+        defaultHistogramOutputFunction(TimerRegistry::name(id), h);
+    }
+
+    static void writePerf(TimerId id, const PerfStats& stats) {
+        defaultAverageTimerInfoOutputFunction(profilerStartTime);
+        defaultPerfOutputFunction(TimerRegistry::name(id), stats);
+    }
+public:
+
+    static void enableThreadLocalBuffers(bool enabled = true) {
+        threadLocalBuffersEnabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    // with thread local buffers as well, the shards take what overflows a thread's ring
+    static void enableCpuShards(bool enabled = true) {
+        cpuShardsEnabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    static void setStartTime(profilerClock::duration t) {
+        profilerStartTime = t;
+        startTimeSet = true;
+    }
+
+    static profilerClock::duration startTime() {
+        return profilerStartTime;
+    }
+
+    // log everything collected so far without resetting it. the lock is only held to copy the
+    // samples, summaries and percentiles are computed after it is released
+    static void averageLog() {
+        std::vector<CollectedTimesCopy> copies;
+        {
+            std::lock_guard<std::mutex> lock(collectedAverageTimesMutex);
+            drainAverageSamples();
+            copies = collectedAverageTimes.copy();
+        }
+        for(auto& c : copies) writeAverage(c.summarize(defaultAverageTimerPercentiles));
+    }
+
+    static void cumulativeLog() {
+        std::vector<CollectedTimesCopy> copies;
+        {
+            std::lock_guard<std::mutex> lock(collectedCumulativeTimesMutex);
+            drainCumulativeSamples();
+            copies = collectedCumulativeTimes.copy();
+        }
+        for(auto& c : copies) writeCumulative(c.summarize());
+    }
+
+    // lock-free when thread local buffers are enabled, a full ring falls back to the locked path
+    static void addAverageTime(TimerId id, profilerClock::ticks t, std::uint32_t weight = 1, const AllocationCounts& allocations = {}) {
+        TimerSample sample{id, weight, t};
+#ifdef PF_TRACK_ALLOCATIONS
+        sample.allocations = allocations;
+#endif
+        if(threadLocalBuffersEnabled.load(std::memory_order_relaxed) && ThreadLocalBuffers<ThreadSampleBuffer>::local().average.push(sample)) return;
+        if(cpuShardsEnabled.load(std::memory_order_relaxed)) {
+            CpuShards::addAverage(id, t, weight, allocations);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(collectedAverageTimesMutex);
+        collectedAverageTimes[id].add(t, weight, allocations);
+    }
+
+    static void addCumulativeTime(TimerId id, profilerClock::ticks t, std::uint32_t weight = 1) {
+        if(threadLocalBuffersEnabled.load(std::memory_order_relaxed) && ThreadLocalBuffers<ThreadSampleBuffer>::local().cumulative.push({id, weight, t})) return;
+        if(cpuShardsEnabled.load(std::memory_order_relaxed)) {
+            CpuShards::addCumulative(id, t, weight);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(collectedCumulativeTimesMutex);
+        collectedCumulativeTimes[id].add(t, weight);
+    }
+
+    static void addAverageTime(std::string_view id, profilerClock::duration t) {
+        addAverageTime(TimerRegistry::registerTimer(id), profilerClock::toTicks(t));
+    }
+
+    static void addCumulativeTime(std::string_view id, profilerClock::duration t) {
+        addCumulativeTime(TimerRegistry::registerCumulativeTimer(id), profilerClock::toTicks(t));
+    }
+
+    static void histogramLog() {
+        std::vector<std::pair<TimerId, Histogram>> histograms;
+        {
+            std::lock_guard<std::mutex> lock(collectedHistogramsMutex);
+            drainHistogramSamples();
+            histograms = collectedHistograms.snapshot();
+        }
+        for(auto& [id, h] : histograms) writeHistogram(id, h);
+    }
+
+    static void addHistogramTime(TimerId id, profilerClock::ticks t, std::uint32_t weight = 1) {
+        if(threadLocalBuffersEnabled.load(std::memory_order_relaxed) && ThreadLocalBuffers<ThreadSampleBuffer>::local().histogram.push({id, weight, t})) return;
+        addSharedHistogramTime(id, t, weight);
+    }
+
+    // for probes that sit on other code's hot path, such as profiled mutexes: goes through the
+    // calling thread's ring whether or not the rings are on for the timers, so unrelated
+    // callers only meet on the histogram mutex once a ring is full
+    static void addLocalHistogramTime(TimerId id, profilerClock::ticks t) {
+        if(ThreadLocalBuffers<ThreadSampleBuffer>::local().histogram.push({id, 1, t})) return;
+        addSharedHistogramTime(id, t, 1);
+    }
+
+    static void perfLog() {
+        std::vector<std::pair<TimerId, PerfStats>> stats;
+        {
+            std::lock_guard<std::mutex> lock(collectedPerfMutex);
+            stats = collectedPerf.snapshot();
+        }
+        for(auto& [id, s] : stats) writePerf(id, s);
+    }
+
+    // deltas has one entry per counter, only the ones in mask are read
+    static void addPerfSample(TimerId id, profilerClock::ticks t, std::uint32_t mask, const std::uint64_t* deltas) {
+        std::lock_guard<std::mutex> lock(collectedPerfMutex);
+        collectedPerf[id].add(t, mask, deltas);
+    }
+
+    // hands a copy of the active buffers to the metrics without retiring anything, for kinds the
+    // metrics would otherwise only see when a report runs. the report lock keeps a report from
+    // folding the same samples into the totals in between
+    static void peekAverages() {
+        std::lock_guard<std::mutex> reportLock(averageReportMutex);
+        std::vector<CollectedTimesCopy> copies;
+        {
+            std::lock_guard<std::mutex> lock(collectedAverageTimesMutex);
+            drainAverageSamples();
+            copies = collectedAverageTimes.copy();
+        }
+        Metrics::setPendingAverages(copies);
+    }
+
+    static void peekCumulatives() {
+        std::lock_guard<std::mutex> reportLock(cumulativeReportMutex);
+        std::vector<CollectedTimesCopy> copies;
+        {
+            std::lock_guard<std::mutex> lock(collectedCumulativeTimesMutex);
+            drainCumulativeSamples();
+            copies = collectedCumulativeTimes.copy();
+        }
+        Metrics::setPendingCumulatives(copies);
+    }
+
+    static void peekHistograms() {
+        std::lock_guard<std::mutex> reportLock(histogramReportMutex);
+        std::vector<std::pair<TimerId, Histogram>> histograms;
+        {
+            std::lock_guard<std::mutex> lock(collectedHistogramsMutex);
+            drainHistogramSamples();
+            histograms = collectedHistograms.snapshot();
+        }
+        Metrics::setPendingHistograms(histograms);
+    }
+
+    static void peekPerf() {
+        std::lock_guard<std::mutex> reportLock(perfReportMutex);
+        std::vector<std::pair<TimerId, PerfStats>> stats;
+        {
+            std::lock_guard<std::mutex> lock(collectedPerfMutex);
+            stats = collectedPerf.snapshot();
+        }
+        Metrics::setPendingPerf(stats);
+    }
+
+    // drops everything id collected so far, for the samples the profiler takes of itself
+    static void discard(TimerId id) {
+        {
+            std::lock_guard<std::mutex> lock(collectedAverageTimesMutex);
+            drainAverageSamples();
+            if(collectedAverageTimes.find(id)) collectedAverageTimes[id].clear();
+        }
+        {
+            std::lock_guard<std::mutex> lock(collectedCumulativeTimesMutex);
+            drainCumulativeSamples();
+            if(collectedCumulativeTimes.find(id)) collectedCumulativeTimes[id].clear();
+        }
+        {
+            std::lock_guard<std::mutex> lock(collectedHistogramsMutex);
+            drainHistogramSamples();
+            if(collectedHistograms.find(id)) collectedHistograms[id].clear();
+        }
+    }
+
+    // log what was collected since the last report and start over.
+    // the producer lock is only held to drain the rings and swap buffers, a sample
+    // lands either in the retired buffer or in the fresh one, never in between
+    // with write false nothing is printed, the retired data only goes to the metrics
+    static void averageReport(bool write = true) {
+        std::lock_guard<std::mutex> reportLock(averageReportMutex);
+        {
+            std::lock_guard<std::mutex> lock(collectedAverageTimesMutex);
+            drainAverageSamples();
+            collectedAverageTimes.swap(retiredAverageTimes);
+        }
+        std::vector<TimerSummary> summaries = retiredAverageTimes.summarize(write ? defaultAverageTimerPercentiles : std::vector<double>());
+        if(Metrics::enabled()) Metrics::addAverages(summaries);
+        if(Metrics::summarizing()) Metrics::addAverageSamples(retiredAverageTimes);
+        if(write) for(auto& summary : summaries) writeAverage(summary);
+        if(CpuShards::breakdown()) {
+            std::map<TimerId, std::vector<CpuShare>> shares = CpuShards::takeAverageShares();
+            if(write) for(auto& [id, s] : shares) defaultCpuBreakdownOutputFunction(TimerRegistry::name(id), s);
+        }
+        retiredAverageTimes.clear();
+    }
+
+    static void cumulativeReport(bool write = true) {
+        std::lock_guard<std::mutex> reportLock(cumulativeReportMutex);
+        {
+            std::lock_guard<std::mutex> lock(collectedCumulativeTimesMutex);
+            drainCumulativeSamples();
+            collectedCumulativeTimes.swap(retiredCumulativeTimes);
+        }
+        std::vector<TimerSummary> summaries = retiredCumulativeTimes.summarize();
+        if(Metrics::enabled()) Metrics::addCumulatives(summaries);
+        if(write) for(auto& summary : summaries) writeCumulative(summary);
+        retiredCumulativeTimes.clear();
+    }
+
+    static void histogramReport(bool write = true) {
+        std::lock_guard<std::mutex> reportLock(histogramReportMutex);
+        {
+            std::lock_guard<std::mutex> lock(collectedHistogramsMutex);
+            drainHistogramSamples();
+            collectedHistograms.swap(retiredHistograms);
+        }
+        if(Metrics::enabled()) Metrics::addHistograms(retiredHistograms);
+        for(TimerId id = 0; write && id < retiredHistograms.size(); id++) {
+            const Histogram* h = retiredHistograms.find(id);
+            if(h && h->count() != 0) writeHistogram(id, *h);
+        }
+        retiredHistograms.clear();
+    }
+
+    static void perfReport(bool write = true) {
+        std::lock_guard<std::mutex> reportLock(perfReportMutex);
+        {
+            std::lock_guard<std::mutex> lock(collectedPerfMutex);
+            collectedPerf.swap(retiredPerf);
+        }
+        std::vector<std::pair<TimerId, PerfStats>> stats = retiredPerf.snapshot();
+        if(Metrics::enabled()) Metrics::addPerf(stats);
+        if(write) for(auto& [id, s] : stats) writePerf(id, s);
+        retiredPerf.clear();
+    }
+
+    static void startAverageLoggingThread() {
+        if(!startTimeSet) setStartTime(profilerClock::now());
+        Reporter::addJob("average", [] { return defaultAverageTimerSleepDuration; }, [] { averageReport(); });
+        Reporter::start();
+    }
+
+    static void startCumulativeLoggingThread() {
+        if(!startTimeSet) setStartTime(profilerClock::now());
+        Reporter::addJob("cumulative", [] { return defaultCumulativeTimerSleepDuration; }, [] { cumulativeReport(); });
+        Reporter::start();
+    }
+
+    static void startHistogramLoggingThread() {
+        if(!startTimeSet) setStartTime(profilerClock::now());
+        Reporter::addJob("histogram", [] { return defaultHistogramTimerSleepDuration; }, [] { histogramReport(); });
+        Reporter::start();
+    }
+
+    static void startPerfLoggingThread() {
+        if(!startTimeSet) setStartTime(profilerClock::now());
+        Reporter::addJob("perf", [] { return defaultPerfTimerSleepDuration; }, [] { perfReport(); });
+        Reporter::start();
+    }
+};
+std::mutex AverageTimerManager::collectedAverageTimesMutex;
+CollectedTimesSlots AverageTimerManager::collectedAverageTimes;
+std::mutex AverageTimerManager::averageReportMutex;
+CollectedTimesSlots AverageTimerManager::retiredAverageTimes;
+
+std::mutex AverageTimerManager::collectedCumulativeTimesMutex;
+CollectedTimesSlots AverageTimerManager::collectedCumulativeTimes;
+std::mutex AverageTimerManager::cumulativeReportMutex;
+CollectedTimesSlots AverageTimerManager::retiredCumulativeTimes;
+
+std::mutex AverageTimerManager::collectedHistogramsMutex;
+HistogramSlots AverageTimerManager::collectedHistograms;
+std::mutex AverageTimerManager::histogramReportMutex;
+HistogramSlots AverageTimerManager::retiredHistograms;
+
+std::mutex AverageTimerManager::collectedPerfMutex;
+PerfSlots AverageTimerManager::collectedPerf;
+std::mutex AverageTimerManager::perfReportMutex;
+PerfSlots AverageTimerManager::retiredPerf;
+
+profilerClock::duration AverageTimerManager::profilerStartTime;
+bool AverageTimerManager::startTimeSet = false;
+
+std::atomic<bool> AverageTimerManager::threadLocalBuffersEnabled{false};
+std::atomic<bool> AverageTimerManager::cpuShardsEnabled{false};
+
+void elapsed_time_colon_t_suffix(profilerClock::duration start) {
+    LineWriter(*defaultProfilerOutputStream) << "|| elapsed time: " << scaledDuration(profilerClock::now() - start) << profilerDurationSuffix << "\n";
+}
+
+void id_colon_t_suffix_out_of_sleepduration(std::string_view id, profilerClock::duration t){
+    LineWriter(*defaultProfilerOutputStream)
+        << "|| " << id << ": " << scaledDuration(t) << profilerDurationSuffix
+        << " out of " << scaledDuration(defaultCumulativeTimerSleepDuration) << profilerDurationSuffix << "\n";
+}
+
+// counters, gauges and throughput timers. every thread updates only its own cells, a cache line
+// per id, with relaxed loads and stores instead of read modify writes, and the reporter sums
+// the cells of all threads. ids past maxPages * cellsPerPage are not recorded
+class Instruments {
+    struct alignas(cacheLineSize) Cell {
+        std::atomic<std::int64_t> value{0};           // counter total, latest gauge value, throughput items
+        std::atomic<profilerClock::ticks> ticks{0};   // when the gauge was set, throughput time
+        std::atomic<std::uint64_t> updates{0};
+    };
+
+    static constexpr std::size_t cellsPerPage = 64;
+    static constexpr std::size_t maxPages = 1024;
+
+    // pages are never moved once published, so the reporter reads them while the owner writes
+    struct Table {
+        std::atomic<Cell*> pages[maxPages] = {};
+        std::atomic<bool> retired{false};
+
+        ~Table() {
+            for(auto& page : pages) delete[] page.load(std::memory_order_relaxed);
+        }
+
+        Cell* cell(TimerId id) {
+            if(id >= maxPages * cellsPerPage) return nullptr;
+            std::atomic<Cell*>& page = pages[id / cellsPerPage];
+            Cell* p = page.load(std::memory_order_relaxed);
+            if(!p) {
+                p = new Cell[cellsPerPage];
+                page.store(p, std::memory_order_release);
+            }
+            return p + id % cellsPerPage;
+        }
+
+        const Cell* find(TimerId id) const {
+            if(id >= maxPages * cellsPerPage) return nullptr;
+            const Cell* p = pages[id / cellsPerPage].load(std::memory_order_acquire);
+            return p ? p + id % cellsPerPage : nullptr;
+        }
+    };
+
+    struct Totals {
+        std::int64_t value = 0;
+        profilerClock::ticks ticks = 0;
+        std::uint64_t updates = 0;
+    };
+
+    // the tables are not kept in ThreadLocalBuffers, whose statics are instantiated after
+    // Reporter::stopper and so are gone by the time the exit flush reports
+    struct Handle {
+        std::shared_ptr<Table> table = std::make_shared<Table>();
+        Handle() {
+            std::lock_guard<std::mutex> lock(tablesMutex);
+            tables.push_back(table);
+        }
+        ~Handle() {
+            table->retired.store(true, std::memory_order_release);
+        }
+    };
+
+    static std::mutex tablesMutex;
+    static std::vector<std::shared_ptr<Table>> tables;
+    static std::mutex kindsMutex;
+    static std::vector<InstrumentKind> kinds;
+    static profilerClock::ticks firstDeclaredAt;
+
+    static Table& local() {
+        thread_local Handle handle;
+        return *handle.table;
+    }
+    static std::mutex instrumentsReportMutex;
+    static ArenaVector<Totals> exitedTotals;
+    static ArenaVector<Totals> reportedTotals;
+    static profilerClock::ticks reportedAt;
+    static std::mutex metricsHandoffMutex; // keeps a report and a peek from handing over the same interval
+
+    static TimerId declare(std::string_view name, InstrumentKind kind, std::string_view suffix = {}) {
+        TimerId id = TimerRegistry::registerTimer(name, suffix);
+        UntrackedAllocations untracked;
+        std::lock_guard<std::mutex> lock(kindsMutex);
+        if(id >= kinds.size()) kinds.resize(id + 1, InstrumentKind::counter);
+        kinds[id] = kind;
+        if(firstDeclaredAt == 0) firstDeclaredAt = profilerClock::nowTicks();
+        return id;
+    }
+
+    static void bump(std::atomic<std::int64_t>& a, std::int64_t n) {
+        a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    static void count(Cell& c) {
+        c.updates.store(c.updates.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    static void fold(Totals& into, const Totals& from, InstrumentKind kind) {
+        into.updates += from.updates;
+        if(kind == InstrumentKind::gauge) {
+            if(from.updates && from.ticks >= into.ticks) {
+                into.value = from.value;
+                into.ticks = from.ticks;
+            }
+        }
+        else {
+            into.value += from.value;
+            into.ticks += from.ticks;
+        }
+    }
+
+    // caller must hold instrumentsReportMutex
+    static std::vector<Totals> collect(const std::vector<InstrumentKind>& current) {
+        std::vector<Totals> totals(current.size());
+        if(exitedTotals.size() < current.size()) exitedTotals.resize(current.size());
+        std::lock_guard<std::mutex> lock(tablesMutex);
+        for(auto it = tables.begin(); it != tables.end();) {
+            const Table& t = **it;
+            // the totals of an exited thread are final, they move to exitedTotals with the table
+            bool exited = t.retired.load(std::memory_order_acquire);
+            for(TimerId id = 0; id < current.size(); id++) {
+                const Cell* c = t.find(id);
+                if(!c) continue;
+                Totals cell{c->value.load(std::memory_order_relaxed), c->ticks.load(std::memory_order_relaxed),
+                            c->updates.load(std::memory_order_relaxed)};
+                fold(exited ? exitedTotals[id] : totals[id], cell, current[id]);
+            }
+            if(exited) it = tables.erase(it);
+            else ++it;
+        }
+        for(TimerId id = 0; id < current.size() && id < exitedTotals.size(); id++) fold(totals[id], exitedTotals[id], current[id]);
+        return totals;
+    }
+
+    static std::vector<std::pair<TimerId, InstrumentReading>> read(bool reset) {
+        std::vector<InstrumentKind> current;
+        profilerClock::ticks declaredAt;
+        {
+            std::lock_guard<std::mutex> lock(kindsMutex);
+            current = kinds;
+            declaredAt = firstDeclaredAt;
+        }
+        std::lock_guard<std::mutex> reportLock(instrumentsReportMutex);
+        std::vector<Totals> totals = collect(current);
+        profilerClock::ticks now = profilerClock::nowTicks();
+        if(reportedAt == 0) reportedAt = declaredAt;
+        if(reportedTotals.size() < totals.size()) reportedTotals.resize(totals.size());
+        std::vector<std::pair<TimerId, InstrumentReading>> readings;
+        for(TimerId id = 0; id < totals.size(); id++) {
+            const Totals& was = reportedTotals[id];
+            if(totals[id].updates == was.updates) continue;
+            InstrumentReading r;
+            r.kind = current[id];
+            r.updates = totals[id].updates - was.updates;
+            r.interval = now - reportedAt;
+            if(r.kind == InstrumentKind::throughput) {
+                r.value = totals[id].value - was.value;
+                r.time = totals[id].ticks - was.ticks;
+            }
+            else {
+                r.value = totals[id].value;
+                r.delta = totals[id].value - was.value;
+            }
+            readings.emplace_back(id, r);
+            if(reset) reportedTotals[id] = totals[id];
+        }
+        if(reset) reportedAt = now;
+        return readings;
+    }
+
+    static void write(const std::vector<std::pair<TimerId, InstrumentReading>>& readings) {
+        if(readings.empty()) return;
+        defaultAverageTimerInfoOutputFunction(AverageTimerManager::startTime());
+        for(auto& [id, r] : readings) defaultInstrumentOutputFunction(TimerRegistry::name(id), r);
+    }
+public:
+    static TimerId registerCounter(std::string_view name) {
+        return declare(name, InstrumentKind::counter);
+    }
+
+    // the filter sees only name
+    static TimerId registerCounter(std::string_view name, std::string_view suffix) {
+        return declare(name, InstrumentKind::counter, suffix);
+    }
+
+    static TimerId registerGauge(std::string_view name) {
+        return declare(name, InstrumentKind::gauge);
+    }
+
+    static TimerId registerThroughput(std::string_view name) {
+        return declare(name, InstrumentKind::throughput);
+    }
+
+    static void add(TimerId id, std::int64_t n) {
+        Cell* c = local().cell(id);
+        if(!c) return;
+        bump(c->value, n);
+        count(*c);
+    }
+
+    // of several threads setting one gauge, the latest set wins
+    static void set(TimerId id, std::int64_t v) {
+        Cell* c = local().cell(id);
+        if(!c) return;
+        c->value.store(v, std::memory_order_relaxed);
+        c->ticks.store(profilerClock::nowTicks(), std::memory_order_relaxed);
+        count(*c);
+    }
+
+    static void addThroughput(TimerId id, std::int64_t items, profilerClock::ticks t) {
+        Cell* c = local().cell(id);
+        if(!c) return;
+        bump(c->value, items);
+        c->ticks.store(c->ticks.load(std::memory_order_relaxed) + t, std::memory_order_relaxed);
+        count(*c);
+    }
+
+    static void log() {
+        write(read(false));
+    }
+
+    static void report(bool write = true) {
+        std::vector<std::pair<TimerId, InstrumentReading>> readings;
+        {
+            std::lock_guard<std::mutex> lock(metricsHandoffMutex);
+            readings = read(true);
+            if(Metrics::enabled()) Metrics::addInstruments(readings);
+        }
+        if(write) Instruments::write(readings);
+    }
+
+    // what report() would hand to the metrics, without starting a new interval
+    static void peek() {
+        std::lock_guard<std::mutex> lock(metricsHandoffMutex);
+        Metrics::setPendingInstruments(read(false));
+    }
+
+    static void startLoggingThread() {
+        Reporter::addJob("instruments", [] { return defaultInstrumentSleepDuration; }, [] { report(); });
+        Reporter::start();
+    }
+};
+std::mutex Instruments::tablesMutex;
+std::vector<std::shared_ptr<Instruments::Table>> Instruments::tables;
+std::mutex Instruments::kindsMutex;
+std::vector<InstrumentKind> Instruments::kinds;
+profilerClock::ticks Instruments::firstDeclaredAt = 0;
+std::mutex Instruments::instrumentsReportMutex;
+ArenaVector<Instruments::Totals> Instruments::exitedTotals;
+ArenaVector<Instruments::Totals> Instruments::reportedTotals;
+profilerClock::ticks Instruments::reportedAt = 0;
+std::mutex Instruments::metricsHandoffMutex;
+
+// keeps the metrics snapshot fresh from the reporter thread. kinds without an auto log job are
+// copied on every refresh, so their data reaches the metrics without being printed or retired
+class MetricsExporter {
+#if defined(__unix__) || defined(__APPLE__)
+    static std::mutex exporterMutex;
+    static std::thread listener;
+    static std::atomic<bool> listening;
+    static int listenFd;
+
+    static void sendAll(int fd, const char* data, std::size_t size) {
+#ifdef MSG_NOSIGNAL
+        constexpr int flags = MSG_NOSIGNAL;
+#else
+        constexpr int flags = 0;
+#endif
+        while(size) {
+            ssize_t sent = ::send(fd, data, size, flags);
+            if(sent <= 0) return;
+            data += sent;
+            size -= (std::size_t)sent;
+        }
+    }
+
+    // one request per connection, anything but GET /metrics is a 404
+    static void serve(int fd) {
+        timeval timeout{1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        std::string request;
+        char buffer[1024];
+        while(request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+            ssize_t n = ::recv(fd, buffer, sizeof(buffer), 0);
+            if(n <= 0) break;
+            request.append(buffer, (std::size_t)n);
+        }
+        std::string_view line(request);
+        line = line.substr(0, line.find("\r\n"));
+        bool metrics = line.rfind("GET /metrics ", 0) == 0 || line == "GET /metrics";
+        std::shared_ptr<const std::string> body = Metrics::current();
+        std::string head = metrics
+            ? "HTTP/1.1 200 OK\r\nContent-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\nContent-Length: "
+                + std::to_string(body->size()) + "\r\nConnection: close\r\n\r\n"
+            : "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        sendAll(fd, head.data(), head.size());
+        if(metrics) sendAll(fd, body->data(), body->size());
+    }
+
+    static void listen() {
+        while(listening.load(std::memory_order_relaxed)) {
+            pollfd p{listenFd, POLLIN, 0};
+            if(poll(&p, 1, 100) <= 0) continue;
+            int client = ::accept(listenFd, nullptr, nullptr);
+            if(client < 0) continue;
+            serve(client);
+            ::close(client);
+        }
+    }
+#endif
+
+    static void refreshJob() {
+        collect();
+        Metrics::publish();
+    }
+public:
+    // kinds without an auto log job are copied, not retired, so the metrics see their data while
+    // manual logs and reports still get all of it
+    static void collect() {
+        if(!Reporter::hasJob("average")) AverageTimerManager::peekAverages();
+        if(!Reporter::hasJob("cumulative")) AverageTimerManager::peekCumulatives();
+        if(!Reporter::hasJob("histogram")) AverageTimerManager::peekHistograms();
+        if(!Reporter::hasJob("perf")) AverageTimerManager::peekPerf();
+        if(!Reporter::hasJob("instruments")) Instruments::peek();
+    }
+
+    // republishes every defaultMetricsSleepDuration without serving anything, for pushing the
+    // snapshot from write() to a pushgateway or a textfile collector
+    static void enable() {
+        Metrics::enable();
+        Reporter::addJob("metrics", [] { return defaultMetricsSleepDuration; }, refreshJob);
+        Reporter::start();
+    }
+
+    // takes what was collected so far into the snapshot right away
+    static void refresh() {
+        Metrics::enable();
+        refreshJob();
+    }
+
+    static void write(std::ostream& out) {
+        out << *Metrics::current();
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    // serves the snapshot over http on address:port, false when the socket cannot be bound
+    static bool start(unsigned short port, const char* address = "127.0.0.1") {
+        std::lock_guard<std::mutex> lock(exporterMutex);
+        if(listening) return true;
+        int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if(fd < 0) return false;
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if(inet_pton(AF_INET, address, &addr.sin_addr) != 1
+            || ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+            || ::listen(fd, 16) != 0) {
+            std::cerr << "profiler: could not listen for metrics on " << address << ":" << port << "\n";
+            ::close(fd);
+            return false;
+        }
+        listenFd = fd;
+        enable();
+        listening = true;
+        listener = std::thread(listen);
+        return true;
+    }
+
+    static void stop() {
+        std::lock_guard<std::mutex> lock(exporterMutex);
+        if(!listening) return;
+        listening = false;
+        listener.join();
+        ::close(listenFd);
+        listenFd = -1;
+    }
+
+    struct Stopper {
+        ~Stopper() { MetricsExporter::stop(); }
+    };
+    static Stopper stopper;
+#endif
+};
+#if defined(__unix__) || defined(__APPLE__)
+std::mutex MetricsExporter::exporterMutex;
+std::thread MetricsExporter::listener;
+std::atomic<bool> MetricsExporter::listening{false};
+int MetricsExporter::listenFd = -1;
+MetricsExporter::Stopper MetricsExporter::stopper;
+#endif
+
+// per-id aggregates of a whole run as json, the input of profiler-diff. kinds with an auto log
+// job only contribute what their last report retired, so enable those before the summary
+class Summary {
+    static std::mutex summaryMutex;
+    static std::string summaryPath;
+
+    static void job() {
+        std::string path;
+        {
+            std::lock_guard<std::mutex> lock(summaryMutex);
+            path = summaryPath;
+        }
+        write(path);
+    }
+public:
+    // keeps the average timer samples for percentiles from now on, without writing anything
+    static void enable() {
+        Metrics::enableSummary();
+    }
+
+    // rewrites path every defaultSummarySleepDuration and once more when the program exits
+    static void enable(const std::string& path) {
+        Metrics::enableSummary();
+        {
+            std::lock_guard<std::mutex> lock(summaryMutex);
+            summaryPath = path;
+        }
+        Reporter::addJob("summary", [] { return defaultSummarySleepDuration; }, job);
+        Reporter::start();
+    }
+
+    static void write(std::ostream& out) {
+        Metrics::enableSummary();
+        MetricsExporter::collect();
+        Metrics::writeSummary(out);
+    }
+
+    // replaces path in one rename, so a reader never sees half a summary
+    static bool write(const std::string& path) {
+        std::string temporary = path + ".tmp";
+        {
+            std::ofstream file(temporary);
+            if(!file) {
+                std::cerr << "could not open summary file " << temporary << "\n";
+                return false;
+            }
+            write(file);
+            if(!file) return false;
+        }
+        return std::rename(temporary.c_str(), path.c_str()) == 0;
+    }
+};
+std::mutex Summary::summaryMutex;
+std::string Summary::summaryPath;
+
+#if defined(__unix__) || defined(__APPLE__)
+#define PF_HAS_SHARED_MEMORY 1
+
+// layout of the segment PF_START_SHARED_MEMORY publishes into and profiler-top reads:
+// a header, a registry of (kind, name) slots shared by every process, a process table and a
+// row of stats per process and slot. a process writes only its own row, and only from the
+// reporter thread, so profiled threads never touch the segment
+inline constexpr char sharedSegmentMagic[8] = {'P', 'F', 'S', 'H', 'M', '0', '0', '1'};
+inline constexpr std::uint32_t sharedSegmentVersion = 1;
+inline constexpr std::size_t sharedNameSize = 120;
+
+enum SharedSlotState : std::uint32_t {
+    sharedSlotFree,
+    sharedSlotClaimed,
+    sharedSlotNamed
+};
+
+struct SharedSegmentHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t maxProcesses;
+    std::uint32_t maxSlots;
+    std::atomic<std::uint32_t> slotsClaimed;
+    std::atomic<std::uint32_t> ready; // set last by the process that created the segment
+};
+
+struct SharedSlot {
+    std::atomic<std::uint32_t> state;
+    std::uint32_t kind; // a StatKind
+    char name[sharedNameSize];
+};
+
+struct alignas(cacheLineSize) SharedProcess {
+    std::atomic<std::int32_t> pid;      // zero when the entry is free
+    std::atomic<std::uint32_t> sequence; // odd while the process writes its row
+    std::atomic<std::int64_t> publishedAt; // unix time in nanoseconds
+    char name[40];
+};
+
+struct SharedStat {
+    std::atomic<std::uint64_t> count;
+    std::atomic<std::int64_t> ns;    // summed duration
+    std::atomic<std::int64_t> value; // counter total, gauge, throughput items
+    std::uint64_t reserved;
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "the shared segment needs address free atomics");
+
+// a mapping of the segment, read write for publishers and read only for readers
+class SharedSegment {
+    void* base = nullptr;
+    std::size_t mapped = 0;
+
+    static std::size_t processesOffset(std::uint32_t maxSlots) {
+        std::size_t end = sizeof(SharedSegmentHeader) + maxSlots * sizeof(SharedSlot);
+        return (end + cacheLineSize - 1) / cacheLineSize * cacheLineSize;
+    }
+
+    bool map(int fd, std::size_t size, bool writable) {
+        void* p = ::mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        if(p == MAP_FAILED) return false;
+        base = p;
+        mapped = size;
+        return true;
+    }
+
+    bool valid() const {
+        const SharedSegmentHeader& h = header();
+        return std::memcmp(h.magic, sharedSegmentMagic, sizeof(h.magic)) == 0 && h.version == sharedSegmentVersion
+            && bytes(h.maxProcesses, h.maxSlots) <= mapped;
+    }
+public:
+    SharedSegment() = default;
+    SharedSegment(const SharedSegment&) = delete;
+    SharedSegment& operator=(const SharedSegment&) = delete;
+    ~SharedSegment() {
+        close();
+    }
+
+    static std::size_t bytes(std::uint32_t maxProcesses, std::uint32_t maxSlots) {
+        return processesOffset(maxSlots) + maxProcesses * (sizeof(SharedProcess) + maxSlots * sizeof(SharedStat));
+    }
+
+    // creates the segment or joins it, the first process decides its dimensions
+    bool create(const std::string& name, std::uint32_t maxProcesses, std::uint32_t maxSlots) {
+        close();
+        int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if(fd >= 0) {
+            std::size_t size = bytes(maxProcesses, maxSlots);
+            if(::ftruncate(fd, (off_t)size) != 0 || !map(fd, size, true)) {
+                ::close(fd);
+                ::shm_unlink(name.c_str());
+                return false;
+            }
+            ::close(fd);
+            SharedSegmentHeader& h = header();
+            std::memcpy(h.magic, sharedSegmentMagic, sizeof(h.magic));
+            h.version = sharedSegmentVersion;
+            h.maxProcesses = maxProcesses;
+            h.maxSlots = maxSlots;
+            h.ready.store(1, std::memory_order_release);
+            return true;
+        }
+        if(errno != EEXIST) return false;
+        return open(name, true);
+    }
+
+    // waits up to a second for a segment another process is still creating
+    bool open(const std::string& name, bool writable = false) {
+        close();
+        int fd = ::shm_open(name.c_str(), writable ? O_RDWR : O_RDONLY, 0);
+        if(fd < 0) return false;
+        bool opened = false;
+        for(int attempt = 0; attempt < 100 && !opened; attempt++) {
+            struct stat st;
+            if(::fstat(fd, &st) == 0 && (std::size_t)st.st_size >= sizeof(SharedSegmentHeader) && map(fd, (std::size_t)st.st_size, writable)) {
+                if(header().ready.load(std::memory_order_acquire) && valid()) opened = true;
+                else unmap();
+            }
+            if(!opened) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        ::close(fd);
+        return opened;
+    }
+
+    void unmap() {
+        if(base) ::munmap(base, mapped);
+        base = nullptr;
+        mapped = 0;
+    }
+
+    void close() {
+        unmap();
+    }
+
+    bool isOpen() const {
+        return base != nullptr;
+    }
+
+    SharedSegmentHeader& header() const {
+        return *static_cast<SharedSegmentHeader*>(base);
+    }
+
+    SharedSlot& slot(std::uint32_t i) const {
+        return reinterpret_cast<SharedSlot*>(static_cast<char*>(base) + sizeof(SharedSegmentHeader))[i];
+    }
+
+    SharedProcess& process(std::uint32_t p) const {
+        return reinterpret_cast<SharedProcess*>(static_cast<char*>(base) + processesOffset(header().maxSlots))[p];
+    }
+
+    SharedStat& stat(std::uint32_t p, std::uint32_t i) const {
+        char* rows = static_cast<char*>(base) + processesOffset(header().maxSlots) + header().maxProcesses * sizeof(SharedProcess);
+        return reinterpret_cast<SharedStat*>(rows)[(std::size_t)p * header().maxSlots + i];
+    }
+
+    // a pid that no longer exists leaves its entry to be reused
+    static bool alive(std::int32_t pid) {
+        return pid > 0 && (::kill(pid, 0) == 0 || errno != ESRCH);
+    }
+};
+
+// publishes this process's metrics totals into a named segment every defaultSharedMemorySleepDuration
+class SharedMemoryExporter {
+    static std::mutex sharedMutex;
+    static SharedSegment segment;
+    static std::uint32_t processIndex;
+    static std::map<std::pair<StatKind, TimerId>, std::uint32_t> slots;
+
+    static bool claimProcess() {
+        std::int32_t self = (std::int32_t)::getpid();
+        for(std::uint32_t p = 0; p < segment.header().maxProcesses; p++) {
+            SharedProcess& entry = segment.process(p);
+            std::int32_t pid = entry.pid.load(std::memory_order_acquire);
+            if(pid != 0 && (pid == self || SharedSegment::alive(pid))) continue;
+            if(!entry.pid.compare_exchange_strong(pid, self)) continue;
+            entry.sequence.store(entry.sequence.load() | 1, std::memory_order_relaxed);
+            for(std::uint32_t i = 0; i < segment.header().maxSlots; i++) {
+                SharedStat& st = segment.stat(p, i);
+                st.count.store(0, std::memory_order_relaxed);
+                st.ns.store(0, std::memory_order_relaxed);
+                st.value.store(0, std::memory_order_relaxed);
+            }
+            std::memset(entry.name, 0, sizeof(entry.name));
+            std::string process = processName();
+            std::memcpy(entry.name, process.data(), std::min(process.size(), sizeof(entry.name) - 1));
+            entry.publishedAt.store(0, std::memory_order_relaxed);
+            entry.sequence.fetch_add(1, std::memory_order_release);
+            processIndex = p;
+            return true;
+        }
+        return false;
+    }
+
+    static std::string processName() {
+#ifdef __linux__
+        std::ifstream comm("/proc/self/comm");
+        std::string name;
+        if(std::getline(comm, name) && !name.empty()) return name;
+#endif
+        return "pid " + std::to_string(::getpid());
+    }
+
+    // the registry is shared by all processes. two of them naming the same slot at once can
+    // end up with a slot each, readers merge slots by kind and name
+    static std::uint32_t slotFor(StatKind kind, TimerId id) {
+        auto known = slots.find({kind, id});
+        if(known != slots.end()) return known->second;
+        SharedSegmentHeader& h = segment.header();
+        const std::string& name = TimerRegistry::name(id);
+        std::string_view key = std::string_view(name).substr(0, sharedNameSize - 1);
+        std::uint32_t claimed = std::min(h.slotsClaimed.load(std::memory_order_acquire), h.maxSlots);
+        for(std::uint32_t i = 0; i < claimed; i++) {
+            SharedSlot& slot = segment.slot(i);
+            if(slot.state.load(std::memory_order_acquire) == sharedSlotNamed && slot.kind == (std::uint32_t)kind
+                && key == std::string_view(slot.name, strnlen(slot.name, sharedNameSize))) {
+                return slots[{kind, id}] = i;
+            }
+        }
+        std::uint32_t i = h.slotsClaimed.fetch_add(1, std::memory_order_acq_rel);
+        if(i >= h.maxSlots) return slots[{kind, id}] = h.maxSlots;
+        SharedSlot& slot = segment.slot(i);
+        slot.state.store(sharedSlotClaimed, std::memory_order_relaxed);
+        slot.kind = (std::uint32_t)kind;
+        std::memset(slot.name, 0, sizeof(slot.name));
+        std::memcpy(slot.name, key.data(), key.size());
+        slot.state.store(sharedSlotNamed, std::memory_order_release);
+        return slots[{kind, id}] = i;
+    }
+
+    static void publish() {
+        std::lock_guard<std::mutex> lock(sharedMutex);
+        if(!segment.isOpen()) return;
+        std::vector<std::tuple<StatKind, TimerId, std::uint64_t, profilerClock::ticks, std::int64_t>> totals;
+        Metrics::forEachTotal([&](StatKind kind, TimerId id, std::uint64_t count, profilerClock::ticks time, std::int64_t value) {
+            totals.emplace_back(kind, id, count, time, value);
+        });
+        SharedProcess& entry = segment.process(processIndex);
+        entry.sequence.fetch_add(1, std::memory_order_acq_rel);
+        for(auto& [kind, id, count, time, value] : totals) {
+            std::uint32_t i = slotFor(kind, id);
+            if(i >= segment.header().maxSlots) continue;
+            SharedStat& st = segment.stat(processIndex, i);
+            st.count.store(count, std::memory_order_relaxed);
+            st.ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(profilerClock::toDuration(time)).count(), std::memory_order_relaxed);
+            st.value.store(value, std::memory_order_relaxed);
+        }
+        entry.publishedAt.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count(), std::memory_order_relaxed);
+        entry.sequence.fetch_add(1, std::memory_order_release);
+    }
+
+    static void publishJob() {
+        MetricsExporter::collect();
+        publish();
+    }
+public:
+    // joins or creates the segment, false when it cannot be mapped or every process entry is taken
+    static bool start(const std::string& name = "/profiler", std::uint32_t maxProcesses = 64, std::uint32_t maxSlots = 1024) {
+        {
+            std::lock_guard<std::mutex> lock(sharedMutex);
+            if(segment.isOpen()) return true;
+            if(!segment.create(name, maxProcesses, maxSlots) || !claimProcess()) {
+                std::cerr << "profiler: could not publish to shared memory segment " << name << "\n";
+                segment.close();
+                return false;
+            }
+        }
+        Metrics::enable();
+        Reporter::addJob("shared memory", [] { return defaultSharedMemorySleepDuration; }, publishJob);
+        Reporter::start();
+        return true;
+    }
+
+    // leaves the segment, which stays for the other processes. the last values are
+    // published by the exit flush, before this runs
+    static void stop() {
+        std::lock_guard<std::mutex> lock(sharedMutex);
+        if(!segment.isOpen()) return;
+        segment.process(processIndex).pid.store(0, std::memory_order_release);
+        segment.close();
+        slots.clear();
+    }
+
+    // removes the name, processes that still have the segment mapped keep using it
+    static void unlink(const std::string& name = "/profiler") {
+        ::shm_unlink(name.c_str());
+    }
+
+    struct Stopper {
+        ~Stopper() { SharedMemoryExporter::stop(); }
+    };
+    static Stopper stopper;
+};
+std::mutex SharedMemoryExporter::sharedMutex;
+SharedSegment SharedMemoryExporter::segment;
+std::uint32_t SharedMemoryExporter::processIndex = 0;
+std::map<std::pair<StatKind, TimerId>, std::uint32_t> SharedMemoryExporter::slots;
+SharedMemoryExporter::Stopper SharedMemoryExporter::stopper;
+#endif
+
+// PF_FRAME_MARK ends the current frame of the calling thread and starts the next. while a
+// thread has marked a frame, its timers add up per id without locking, each mark folds them
+// into per frame stats and keeps the breakdown of the worst frames over the budget.
+// timers on threads that never mark are not part of any frame
+class FrameTracker {
+    struct ScopeTotals {
+        std::uint64_t calls = 0;
+        profilerClock::ticks time = 0;
+    };
+
+    struct ThreadState {
+        ArenaVector<ScopeTotals> totals;
+        ArenaVector<TimerId> touched;
+        profilerClock::ticks frameStart = 0;
+        bool started = false;
+    };
+
+    struct Capture {
+        std::uint64_t frame;
+        profilerClock::ticks duration;
+        std::vector<std::pair<TimerId, ScopeTotals>> scopes;
+
+        bool operator>(const Capture& other) const { return duration > other.duration; }
+    };
+
+    struct ScopeFrames {
+        std::uint64_t calls = 0;
+        RunningStats perFrame;
+    };
+
+    struct FrameSet {
+        std::uint64_t frameCount = 0; // never reset, indexes the frames
+        RunningStats frames;
+        std::uint64_t overBudget = 0;
+        std::vector<ScopeFrames> scopes;
+        std::vector<Capture> worst; // min heap on duration, the shortest kept frame on top
+    };
+
+    static std::mutex framesMutex;
+    static std::map<TimerId, FrameSet> sets;
+    static thread_local ThreadState* activeState;
+
+    static ThreadState& local() {
+        thread_local ThreadState state;
+        return state;
+    }
+
+    // caller must hold framesMutex
+    static void capture(FrameSet& set, std::uint64_t frame, profilerClock::ticks duration, const ThreadState& state) {
+        if(set.worst.size() >= PF_WORST_FRAMES && duration <= set.worst.front().duration) return;
+        Capture c{frame, duration, {}};
+        for(TimerId id : state.touched) c.scopes.emplace_back(id, state.totals[id]);
+        std::sort(c.scopes.begin(), c.scopes.end(), [](auto& a, auto& b) { return a.second.time > b.second.time; });
+        auto later = std::greater<Capture>();
+        if(set.worst.size() >= PF_WORST_FRAMES) {
+            std::pop_heap(set.worst.begin(), set.worst.end(), later);
+            set.worst.back() = std::move(c);
+        }
+        else set.worst.push_back(std::move(c));
+        std::push_heap(set.worst.begin(), set.worst.end(), later);
+    }
+
+    static FrameReport resolve(const FrameSet& set, profilerClock::ticks budget) {
+        FrameReport report;
+        report.frames = set.frames;
+        report.budget = budget;
+        report.overBudget = set.overBudget;
+        for(TimerId id = 0; id < set.scopes.size(); id++) {
+            if(set.scopes[id].calls) report.scopes.push_back({TimerRegistry::name(id), set.scopes[id].calls, set.scopes[id].perFrame});
+        }
+        std::sort(report.scopes.begin(), report.scopes.end(), [](auto& a, auto& b) { return a.perFrame.sum > b.perFrame.sum; });
+        for(auto& c : set.worst) {
+            FrameBreakdown frame{c.frame, c.duration, {}};
+            for(auto& [id, totals] : c.scopes) frame.scopes.push_back({TimerRegistry::name(id), totals.calls, totals.time});
+            report.worst.push_back(std::move(frame));
+        }
+        std::sort(report.worst.begin(), report.worst.end(), [](auto& a, auto& b) { return a.duration > b.duration; });
+        return report;
+    }
+
+    static void write(bool reset) {
+        std::vector<std::pair<TimerId, FrameSet>> collected;
+        {
+            std::lock_guard<std::mutex> lock(framesMutex);
+            for(auto& [id, set] : sets) {
+                if(set.frames.count == 0) continue;
+                collected.emplace_back(id, set);
+                if(reset) set = FrameSet{set.frameCount, {}, 0, {}, {}};
+            }
+        }
+        profilerClock::ticks budget = profilerClock::toTicks(defaultFrameBudget);
+        for(auto& [id, set] : collected) {
+            defaultAverageTimerInfoOutputFunction(AverageTimerManager::startTime());
+            defaultFrameOutputFunction(TimerRegistry::name(id), resolve(set, budget));
+        }
+    }
+public:
+    static bool recording() {
+        return activeState != nullptr;
+    }
+
+    static void record(TimerId id, profilerClock::ticks t) {
+        ThreadState* state = activeState;
+        if(!state || id == invalidTimerId) return;
+        if(id >= state->totals.size()) state->totals.resize(id + 1);
+        ScopeTotals& totals = state->totals[id];
+        if(totals.calls == 0) state->touched.push_back(id);
+        totals.calls++;
+        totals.time += t;
+    }
+
+    // the first mark on a thread only starts its first frame. a switched off mark stops the
+    // thread's frame, the first mark after switching it back on starts a fresh one
+    static void mark(TimerId frameId) {
+        ThreadState& state = local();
+        if(!ProbeFilter::enabled(frameId)) {
+            activeState = nullptr;
+            for(TimerId id : state.touched) state.totals[id] = ScopeTotals();
+            state.touched.clear();
+            state.started = false;
+            return;
+        }
+        profilerClock::ticks now = profilerClock::nowTicks();
+        activeState = &state;
+        if(state.started) {
+            profilerClock::ticks duration = now - state.frameStart;
+            profilerClock::ticks budget = profilerClock::toTicks(defaultFrameBudget);
+            std::lock_guard<std::mutex> lock(framesMutex);
+            FrameSet& set = sets[frameId];
+            std::uint64_t frame = set.frameCount++;
+            set.frames.add(duration);
+            for(TimerId id : state.touched) {
+                if(id >= set.scopes.size()) set.scopes.resize(id + 1);
+                set.scopes[id].calls += state.totals[id].calls;
+                set.scopes[id].perFrame.add(state.totals[id].time);
+            }
+            if(budget > 0 && duration > budget) {
+                set.overBudget++;
+                capture(set, frame, duration, state);
+            }
+        }
+        for(TimerId id : state.touched) state.totals[id] = ScopeTotals();
+        state.touched.clear();
+        state.started = true;
+        // the next frame starts where this one ended, so the mark's own cost and any wait on
+        // framesMutex count toward it and consecutive frames add up to wall time
+        state.frameStart = now;
+    }
+
+    static void log() {
+        write(false);
+    }
+
+    static void report() {
+        write(true);
+    }
+
+    static void startLoggingThread() {
+        Reporter::addJob("frame", [] { return defaultFrameSleepDuration; }, report);
+        Reporter::start();
+    }
+};
+std::mutex FrameTracker::framesMutex;
+std::map<TimerId, FrameTracker::FrameSet> FrameTracker::sets;
+thread_local FrameTracker::ThreadState* FrameTracker::activeState = nullptr;
+
+#if defined(__unix__) || defined(__APPLE__)
+#define PF_HAS_BINARY_LOG 1
+
+struct BinaryLogRecord {
+    TimerId id;
+    std::uint32_t thread;
+    profilerClock::ticks start;
+    profilerClock::ticks duration;
+};
+
+// file layout: header, string table region (stringTableCapacity bytes, names in TimerId
+// order as u32 length + bytes), then recordCapacity records. records that were reserved
+// but never written stay zeroed and are skipped by the decoder
+struct BinaryLogHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t recordSize;
+    std::uint64_t recordCapacity;
+    std::uint64_t recordCount;
+    std::uint64_t droppedRecords;
+    std::uint64_t stringTableOffset;
+    std::uint64_t stringTableCapacity;
+    std::uint64_t stringTableSize;
+    std::uint64_t stringCount;
+    std::uint64_t recordsOffset;
+    double nsPerTick; // 0 until the log was flushed
+};
+
+inline constexpr char binaryLogMagic[8] = {'P', 'F', 'B', 'L', 'O', 'G', '\0', '\0'};
+inline constexpr std::uint32_t binaryLogVersion = 1;
+
+// a binary log read back by the tools, records holds only the ones that were written
+struct BinaryLogContents {
+    BinaryLogHeader header;
+    std::vector<std::string> names;
+    std::vector<BinaryLogRecord> records;
+};
+
+// checks every offset and length in the file against its size before following it, on failure
+// error says what is wrong with the file
+inline bool readBinaryLog(const char* data, std::size_t size, BinaryLogContents& log, std::string& error) {
+    BinaryLogHeader& header = log.header;
+    if(size < sizeof(header)) {
+        error = "is too small to be a binary log";
+        return false;
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if(std::memcmp(header.magic, binaryLogMagic, sizeof(header.magic)) != 0
+        || header.version != binaryLogVersion || header.recordSize != sizeof(BinaryLogRecord)) {
+        error = "is not a binary log of this version";
+        return false;
+    }
+    if(header.recordsOffset > size || header.recordCount > (size - header.recordsOffset) / header.recordSize
+        || header.stringTableOffset > size || header.stringTableSize > size - header.stringTableOffset) {
+        error = "is truncated";
+        return false;
+    }
+    log.names.clear();
+    const char* table = data + header.stringTableOffset;
+    for(std::uint64_t used = 0; log.names.size() < header.stringCount;) {
+        std::uint32_t length;
+        if(header.stringTableSize - used < sizeof(length)) {
+            error = "has a truncated string table";
+            return false;
+        }
+        std::memcpy(&length, table + used, sizeof(length));
+        used += sizeof(length);
+        if(length > header.stringTableSize - used) {
+            error = "has a truncated string table";
+            return false;
+        }
+        log.names.emplace_back(table + used, length);
+        used += length;
+    }
+    log.records.clear();
+    log.records.reserve((std::size_t)header.recordCount);
+    BinaryLogRecord empty{};
+    for(std::uint64_t i = 0; i < header.recordCount; i++) {
+        BinaryLogRecord r;
+        std::memcpy(&r, data + header.recordsOffset + i * header.recordSize, sizeof(r));
+        if(std::memcmp(&r, &empty, sizeof(r)) != 0) log.records.push_back(r);
+    }
+    return true;
+}
+
+// fixed-size records written into a preallocated memory-mapped file. every thread reserves
+// blocks of PF_BINARY_LOG_BLOCK_RECORDS with one atomic add and fills them without
+// synchronization, the string table and header are written on flush/close
+class BinaryLog {
+    struct ThreadBlock {
+        BinaryLogRecord* cursor = nullptr;
+        BinaryLogRecord* end = nullptr;
+        std::uint64_t generation = 0;
+    };
+
+    static std::mutex logMutex;
+    static std::atomic<bool> logActive;
+    static std::atomic<std::uint64_t> generation;
+    static std::atomic<std::uint64_t> nextRecord;
+    static std::atomic<std::uint64_t> droppedRecords;
+    static std::atomic<BinaryLogRecord*> records;
+    static std::uint64_t recordCapacity;
+    static BinaryLogHeader* header;
+    static std::size_t mappingSize;
+    static int fd;
+
+    static bool reserve(ThreadBlock& block, std::uint64_t gen) {
+        block.generation = gen;
+        block.cursor = block.end = nullptr;
+        std::uint64_t first = nextRecord.fetch_add(PF_BINARY_LOG_BLOCK_RECORDS, std::memory_order_relaxed);
+        if(first >= recordCapacity) return false;
+        BinaryLogRecord* base = records.load(std::memory_order_relaxed);
+        block.cursor = base + first;
+        block.end = base + std::min<std::uint64_t>(first + PF_BINARY_LOG_BLOCK_RECORDS, recordCapacity);
+        return true;
+    }
+
+    // caller holds logMutex
+    static void writeHeader() {
+        BinaryLogHeader& h = *header;
+        char* table = (char*)header + h.stringTableOffset;
+        std::uint64_t used = 0, count = 0;
+        for(TimerId id = 0; id < TimerRegistry::size(); id++) {
+            const std::string& name = TimerRegistry::name(id);
+            std::uint32_t length = (std::uint32_t)name.size();
+            if(used + sizeof(length) + length > h.stringTableCapacity) {
+                std::cerr << "binary log string table is full, names from id " << id << " on are missing\n";
+                break;
+            }
+            std::memcpy(table + used, &length, sizeof(length));
+            std::memcpy(table + used + sizeof(length), name.data(), length);
+            used += sizeof(length) + length;
+            count++;
+        }
+        h.stringTableSize = used;
+        h.stringCount = count;
+        h.recordCount = std::min(nextRecord.load(std::memory_order_relaxed), recordCapacity);
+        h.droppedRecords = droppedRecords.load(std::memory_order_relaxed);
+        h.nsPerTick = (double)profilerClock::toDuration(1000000000).count() / 1e9;
+        msync(header, mappingSize, MS_SYNC);
+    }
+
+    // the mapping is kept alive after closing, so probes that are still running
+    // never write into unmapped memory
+    static void closeLocked() {
+        if(!header) return;
+        logActive.store(false, std::memory_order_relaxed);
+        writeHeader();
+        ::close(fd);
+        header = nullptr;
+        fd = -1;
+    }
+
+public:
+    static bool active() {
+        return logActive.load(std::memory_order_relaxed);
+    }
+
+    static bool open(const std::string& path, std::uint64_t capacity, std::uint64_t stringTableCapacity = PF_BINARY_LOG_STRING_TABLE_SIZE) {
+        std::lock_guard<std::mutex> lock(logMutex);
+        closeLocked();
+        std::uint64_t recordsOffset = (sizeof(BinaryLogHeader) + stringTableCapacity + 63) & ~std::uint64_t(63);
+        std::size_t size = (std::size_t)(recordsOffset + capacity * sizeof(BinaryLogRecord));
+        int f = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if(f < 0 || ftruncate(f, (off_t)size) != 0) {
+            std::cerr << "could not create binary log " << path << "\n";
+            if(f >= 0) ::close(f);
+            return false;
+        }
+        void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, f, 0);
+        if(mapping == MAP_FAILED) {
+            std::cerr << "could not map binary log " << path << "\n";
+            ::close(f);
+            return false;
+        }
+        fd = f;
+        mappingSize = size;
+        header = new(mapping) BinaryLogHeader{};
+        std::memcpy(header->magic, binaryLogMagic, sizeof(binaryLogMagic));
+        header->version = binaryLogVersion;
+        header->recordSize = sizeof(BinaryLogRecord);
+        header->recordCapacity = capacity;
+        header->stringTableOffset = sizeof(BinaryLogHeader);
+        header->stringTableCapacity = stringTableCapacity;
+        header->recordsOffset = recordsOffset;
+
+        recordCapacity = capacity;
+        nextRecord.store(0, std::memory_order_relaxed);
+        droppedRecords.store(0, std::memory_order_relaxed);
+        records.store((BinaryLogRecord*)((char*)mapping + recordsOffset), std::memory_order_relaxed);
+        generation.fetch_add(1, std::memory_order_release);
+        logActive.store(true, std::memory_order_release);
+        return true;
+    }
+
+    static void write(TimerId id, profilerClock::ticks start, profilerClock::ticks duration) {
+        thread_local ThreadBlock block;
+        std::uint64_t gen = generation.load(std::memory_order_acquire);
+        if((block.generation != gen || block.cursor == block.end) && !reserve(block, gen)) {
+            droppedRecords.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        *block.cursor++ = {id, currentThreadIndex(), start, duration};
+    }
+
+    static void flush() {
+        std::lock_guard<std::mutex> lock(logMutex);
+        if(header) writeHeader();
+    }
+
+    static std::uint64_t dropped() {
+        return droppedRecords.load(std::memory_order_relaxed);
+    }
+
+    static void close() {
+        std::lock_guard<std::mutex> lock(logMutex);
+        closeLocked();
+    }
+
+    struct Closer {
+        ~Closer() { BinaryLog::close(); }
+    };
+    static Closer closer;
+};
+std::mutex BinaryLog::logMutex;
+std::atomic<bool> BinaryLog::logActive{false};
+std::atomic<std::uint64_t> BinaryLog::generation{0};
+std::atomic<std::uint64_t> BinaryLog::nextRecord{0};
+std::atomic<std::uint64_t> BinaryLog::droppedRecords{0};
+std::atomic<BinaryLogRecord*> BinaryLog::records{nullptr};
+std::uint64_t BinaryLog::recordCapacity = 0;
+BinaryLogHeader* BinaryLog::header = nullptr;
+std::size_t BinaryLog::mappingSize = 0;
+int BinaryLog::fd = -1;
+BinaryLog::Closer BinaryLog::closer;
+#endif
+
+// bounded lock-free multi-producer queue (Vyukov), capacity is rounded up to a power of two
+template <typename T>
+class BoundedMpmcQueue {
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+    std::unique_ptr<Cell[]> cells;
+    std::size_t mask;
+    alignas(64) std::atomic<std::size_t> enqueuePos{0};
+    alignas(64) std::atomic<std::size_t> dequeuePos{0};
+public:
+    explicit BoundedMpmcQueue(std::size_t capacity) {
+        std::size_t size = 2;
+        while(size < capacity) size <<= 1;
+        cells.reset(new Cell[size]);
+        mask = size - 1;
+        for(std::size_t i = 0; i < size; i++) cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    bool tryPush(const T& value) {
+        std::size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        while(true) {
+            Cell& cell = cells[pos & mask];
+            std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+            std::intptr_t diff = (std::intptr_t)seq - (std::intptr_t)pos;
+            if(diff == 0) {
+                if(enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if(diff < 0) return false;
+            else pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    bool tryPop(T& value) {
+        std::size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        while(true) {
+            Cell& cell = cells[pos & mask];
+            std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+            std::intptr_t diff = (std::intptr_t)seq - (std::intptr_t)(pos + 1);
+            if(diff == 0) {
+                if(dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = cell.value;
+                    cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if(diff < 0) return false;
+            else pos = dequeuePos.load(std::memory_order_relaxed);
+        }
+    }
+};
+
+enum class BackPressurePolicy {
+    dropNewest, // discard the record that does not fit
+    dropOldest, // discard the oldest queued record to make room
+    block       // wait for the writer thread to make room
+};
+
+// scope timer results are queued and formatted by a writer thread running
+// defaultProfilerOutputFunction, so profiled threads never wait on the output stream
+class AsyncOutput {
+    struct Record {
+        const char* id;
+        profilerClock::ticks duration;
+    };
+
+    static std::mutex asyncOutputMutex;
+    static std::unique_ptr<BoundedMpmcQueue<Record>> queue;
+    static std::atomic<bool> asyncEnabled;
+    static std::atomic<bool> stopping;
+    static std::atomic<BackPressurePolicy> policy;
+    static std::atomic<std::uint64_t> droppedRecords;
+    static std::thread writer;
+
+    static std::size_t drain() {
+        std::size_t n = 0;
+        Record r;
+        while(queue->tryPop(r)) {
+            defaultProfilerOutputFunction(r.id, profilerClock::toDuration(r.duration));
+            n++;
+        }
+        return n;
+    }
+
+    static void writerLoop() {
+        auto idle = std::chrono::microseconds(50);
+        while(!stopping.load(std::memory_order_acquire)) {
+            if(drain()) idle = std::chrono::microseconds(50);
+            else {
+                std::this_thread::sleep_for(idle);
+                idle = std::min<std::chrono::microseconds>(idle * 2, std::chrono::milliseconds(5));
+            }
+        }
+        drain();
+    }
+
+public:
+    // the queue is created by the first call, later calls only change the policy
+    static void start(BackPressurePolicy backPressure = BackPressurePolicy::dropNewest, std::size_t capacity = PF_ASYNC_OUTPUT_CAPACITY) {
+        std::lock_guard<std::mutex> lock(asyncOutputMutex);
+        policy.store(backPressure, std::memory_order_relaxed);
+        if(asyncEnabled.load(std::memory_order_relaxed)) return;
+        if(!queue) queue = std::make_unique<BoundedMpmcQueue<Record>>(capacity);
+        stopping.store(false, std::memory_order_relaxed);
+        writer = std::thread(writerLoop);
+        asyncEnabled.store(true, std::memory_order_release);
+    }
+
+    // writes out everything still queued before returning
+    static void stop() {
+        std::lock_guard<std::mutex> lock(asyncOutputMutex);
+        if(!asyncEnabled.load(std::memory_order_relaxed)) return;
+        asyncEnabled.store(false, std::memory_order_relaxed);
+        stopping.store(true, std::memory_order_release);
+        writer.join();
+    }
+
+    static bool enabled() {
+        return asyncEnabled.load(std::memory_order_acquire);
+    }
+
+    static void push(const char* id, profilerClock::ticks duration) {
+        Record r{id, duration};
+        if(queue->tryPush(r)) return;
+        switch(policy.load(std::memory_order_relaxed)) {
+            case BackPressurePolicy::dropNewest:
+                droppedRecords.fetch_add(1, std::memory_order_relaxed);
+                return;
+            case BackPressurePolicy::dropOldest: {
+                Record oldest;
+                do {
+                    if(queue->tryPop(oldest)) droppedRecords.fetch_add(1, std::memory_order_relaxed);
+                } while(!queue->tryPush(r));
+                return;
+            }
+            case BackPressurePolicy::block:
+                while(!queue->tryPush(r)) {
+                    if(!asyncEnabled.load(std::memory_order_relaxed)) {
+                        droppedRecords.fetch_add(1, std::memory_order_relaxed);
+                        return;
+                    }
+                    std::this_thread::yield();
+                }
+                return;
+        }
+    }
+
+    static std::uint64_t dropped() {
+        return droppedRecords.load(std::memory_order_relaxed);
+    }
+
+    struct Stopper {
+        ~Stopper() { AsyncOutput::stop(); }
+    };
+    static Stopper stopper;
+};
+std::mutex AsyncOutput::asyncOutputMutex;
+std::unique_ptr<BoundedMpmcQueue<AsyncOutput::Record>> AsyncOutput::queue;
+std::atomic<bool> AsyncOutput::asyncEnabled{false};
+std::atomic<bool> AsyncOutput::stopping{false};
+std::atomic<BackPressurePolicy> AsyncOutput::policy{BackPressurePolicy::dropNewest};
+std::atomic<std::uint64_t> AsyncOutput::droppedRecords{0};
+std::thread AsyncOutput::writer;
+AsyncOutput::Stopper AsyncOutput::stopper;
+
+// aggregated call tree of scope timers, one node per parent -> child id path. every
+// thread builds its own tree without locking, children are published with release
+// stores so writeReport()/writeFolded() can walk live trees from another thread
+struct CallTreeNode {
+    TimerId id;
+    const char* name;
+    CallTreeNode* parent;
+    std::atomic<CallTreeNode*> firstChild{nullptr};
+    std::atomic<CallTreeNode*> nextSibling{nullptr};
+    std::atomic<std::uint64_t> calls{0};
+    std::atomic<profilerClock::ticks> inclusive{0};
+    std::atomic<profilerClock::ticks> exclusive{0};
+
+    CallTreeNode(TimerId _id, const char* _name, CallTreeNode* _parent) : id(_id), name(_name), parent(_parent) {}
+};
+
+struct ThreadCallTree {
+    struct Frame {
+        CallTreeNode* node;
+        profilerClock::ticks childTime;
+        profilerClock::ticks overhead; // what the probes of the scopes below cost, while subtracting
+    };
+
+    std::deque<CallTreeNode> nodes;
+    std::vector<Frame> stack;
+    CallTreeNode* current;
+    std::atomic<bool> retired{false};
+    bool merged = false; // set once an exited thread's tree was folded into the shared report
+
+    ThreadCallTree() {
+        nodes.emplace_back(invalidTimerId, nullptr, nullptr);
+        current = &nodes.front();
+    }
+
+    const CallTreeNode& root() const {
+        return nodes.front();
+    }
+
+    bool empty() const {
+        return merged;
+    }
+
+    void enter(TimerId id, const char* name) {
+        CallTreeNode* child = current->firstChild.load(std::memory_order_relaxed);
+        CallTreeNode* last = nullptr;
+        for(; child && child->id != id; child = child->nextSibling.load(std::memory_order_relaxed)) last = child;
+        if(!child) {
+            child = &nodes.emplace_back(id, name, current);
+            if(last) last->nextSibling.store(child, std::memory_order_release);
+            else current->firstChild.store(child, std::memory_order_release);
+        }
+        stack.push_back({child, 0, 0});
+        current = child;
+    }
+
+    // only the owning thread writes, so plain load/store pairs are enough
+    void exit(profilerClock::ticks elapsed) {
+        Frame frame = stack.back();
+        stack.pop_back();
+        elapsed = std::max<profilerClock::ticks>(elapsed - frame.overhead, 0);
+        CallTreeNode& n = *frame.node;
+        n.calls.store(n.calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        n.inclusive.store(n.inclusive.load(std::memory_order_relaxed) + elapsed, std::memory_order_relaxed);
+        n.exclusive.store(n.exclusive.load(std::memory_order_relaxed) + std::max<profilerClock::ticks>(elapsed - frame.childTime, 0), std::memory_order_relaxed);
+        if(!stack.empty()) {
+            stack.back().childTime += elapsed;
+            if(ProbeOverhead::subtracting()) stack.back().overhead += frame.overhead + ProbeOverhead::callTreeScope();
+        }
+        current = n.parent;
+    }
+};
+
+class CallTree {
+    struct ReportNode {
+        const char* name = nullptr;
+        std::uint64_t calls = 0;
+        profilerClock::ticks inclusive = 0;
+        profilerClock::ticks exclusive = 0;
+        std::map<TimerId, ReportNode> children;
+    };
+
+    static std::atomic<bool> callTreeEnabled;
+    static std::mutex callTreeMutex;
+    static ReportNode exitedThreads;
+
+    static void merge(ReportNode& into, const CallTreeNode& node) {
+        for(const CallTreeNode* c = node.firstChild.load(std::memory_order_acquire); c; c = c->nextSibling.load(std::memory_order_acquire)) {
+            ReportNode& r = into.children[c->id];
+            r.name = c->name;
+            r.calls += c->calls.load(std::memory_order_relaxed);
+            r.inclusive += c->inclusive.load(std::memory_order_relaxed);
+            r.exclusive += c->exclusive.load(std::memory_order_relaxed);
+            merge(r, *c);
+        }
+    }
+
+    static void merge(ReportNode& into, const ReportNode& node) {
+        for(auto& [id, c] : node.children) {
+            ReportNode& r = into.children[id];
+            r.name = c.name;
+            r.calls += c.calls;
+            r.inclusive += c.inclusive;
+            r.exclusive += c.exclusive;
+            merge(r, c);
+        }
+    }
+
+    // caller holds callTreeMutex
+    static ReportNode snapshot() {
+        ThreadLocalBuffers<ThreadCallTree>::forEach([](ThreadCallTree& t) {
+            if(t.retired.load(std::memory_order_acquire) && !t.merged) {
+                merge(exitedThreads, t.root());
+                t.merged = true;
+            }
+        });
+        ReportNode result;
+        merge(result, exitedThreads);
+        ThreadLocalBuffers<ThreadCallTree>::forEach([&](ThreadCallTree& t) {
+            if(!t.merged) merge(result, t.root());
+        });
+        return result;
+    }
+
+    static void writeReportNode(std::ostream& out, const ReportNode& node, int depth) {
+        auto scaled = [](profilerClock::ticks t) { return std::chrono::duration<double>(profilerClock::toDuration(t)).count() * profilerDurationScale; };
+        std::string_view suffix = profilerDurationSuffix;
+        for(auto& [id, c] : node.children) {
+            out << "|| " << std::string((std::size_t)depth * 2, ' ') << c.name
+                << ": calls " << c.calls
+                << ", inclusive " << scaled(c.inclusive) << suffix
+                << ", exclusive " << scaled(c.exclusive) << suffix << "\n";
+            writeReportNode(out, c, depth + 1);
+        }
+    }
+
+    static void writeFoldedNode(std::ostream& out, const ReportNode& node, std::string& path) {
+        for(auto& [id, c] : node.children) {
+            std::size_t length = path.size();
+            if(length) path += ';';
+            for(const char* p = c.name; *p; p++) path += *p == ';' ? '_' : *p;
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(profilerClock::toDuration(c.exclusive)).count();
+            if(ns > 0) out << path << " " << ns << "\n";
+            writeFoldedNode(out, c, path);
+            path.resize(length);
+        }
+    }
+
+public:
+    static void enable(bool enabled = true) {
+        callTreeEnabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    static bool enabled() {
+        return callTreeEnabled.load(std::memory_order_relaxed);
+    }
+
+    static ThreadCallTree& local() {
+        return ThreadLocalBuffers<ThreadCallTree>::local();
+    }
+
+    // indented report with call counts, inclusive and exclusive time per path
+    static void writeReport(std::ostream& out) {
+        std::lock_guard<std::mutex> lock(callTreeMutex);
+        out << std::setprecision(6);
+        writeReportNode(out, snapshot(), 0);
+    }
+
+    // one "a;b;c <exclusive ns>" line per path, the input format of flamegraph.pl and speedscope
+    static void writeFolded(std::ostream& out) {
+        std::lock_guard<std::mutex> lock(callTreeMutex);
+        std::string path;
+        writeFoldedNode(out, snapshot(), path);
+    }
+};
+std::atomic<bool> CallTree::callTreeEnabled{false};
+std::mutex CallTree::callTreeMutex;
+CallTree::ReportNode CallTree::exitedThreads;
+
+struct SamplingPolicy {
+    enum class Mode {
+        everyNth, // deterministic, every nth call of the site on each thread
+        random    // each call with probability 1/n
+    };
+    Mode mode;
+    std::uint32_t n;
+};
+
+constexpr SamplingPolicy everyNth(std::uint32_t n) {
+    return {SamplingPolicy::Mode::everyNth, n};
+}
+
+constexpr SamplingPolicy oneIn(std::uint32_t n) {
+    return {SamplingPolicy::Mode::random, n};
+}
+
+// per-thread xorshift64, seeded from the thread index
+inline std::uint32_t threadRandom() {
+    thread_local std::uint64_t state = 0x9E3779B97F4A7C15ull * (currentThreadIndex() + 1);
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return (std::uint32_t)(state >> 32);
+}
+
+// lives in a thread_local at the call site, sample() returns the weight of the
+// current call, 0 for calls that are skipped
+class SiteSampler {
+    SamplingPolicy policy;
+    std::uint32_t counter = 0;
+public:
+    constexpr explicit SiteSampler(SamplingPolicy p) : policy(p) {}
+
+    std::uint32_t sample() {
+        if(policy.n <= 1) return 1;
+        if(policy.mode == SamplingPolicy::Mode::everyNth) {
+            if(++counter < policy.n) return 0;
+            counter = 0;
+            return policy.n;
+        }
+        return (((std::uint64_t)threadRandom() * policy.n) >> 32) == 0 ? policy.n : 0;
+    }
+};
+
+inline void logBinaryRecord(TimerId id, profilerClock::ticks start, profilerClock::ticks duration) {
+#ifdef PF_HAS_BINARY_LOG
+    if(BinaryLog::active()) BinaryLog::write(id, start, duration);
+#endif
+}
+
+// hardware counters of the calling thread, opened on first use. only user space is counted,
+// which perf_event_paranoid 2 still allows. counters are read with rdpmc when the kernel
+// allows it and with read(2) otherwise
+class PerfEvents {
+    int fds[perfCounterCount] = {-1, -1, -1, -1};
+#ifdef PF_HAS_PERF_EVENTS
+    perf_event_mmap_page* pages[perfCounterCount] = {};
+#endif
+    std::uint32_t attempted = 0;
+    std::uint32_t available = 0;
+
+#ifdef PF_HAS_PERF_EVENTS
+    // the generic cache misses event counts last level cache misses on common cpus
+    static constexpr std::uint64_t configs[perfCounterCount] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    void openCounter(std::size_t i) {
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+        if(fd < 0) return;
+        fds[i] = fd;
+        void* page = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+        if(page != MAP_FAILED) pages[i] = static_cast<perf_event_mmap_page*>(page);
+        available |= 1u << i;
+    }
+#endif
+public:
+    PerfEvents() = default;
+    PerfEvents(const PerfEvents&) = delete;
+    PerfEvents& operator=(const PerfEvents&) = delete;
+    ~PerfEvents() {
+#ifdef PF_HAS_PERF_EVENTS
+        for(std::size_t i = 0; i < perfCounterCount; i++) {
+            if(pages[i]) munmap(pages[i], sysconf(_SC_PAGESIZE));
+            if(fds[i] >= 0) ::close(fds[i]);
+        }
+#endif
+    }
+
+    static PerfEvents& local() {
+        thread_local PerfEvents events;
+        return events;
+    }
+
+    // opens what was not tried yet, returns the requested counters that can be read
+    std::uint32_t open(std::uint32_t counters) {
+#ifdef PF_HAS_PERF_EVENTS
+        for(std::size_t i = 0; i < perfCounterCount; i++) {
+            std::uint32_t bit = 1u << i;
+            if((counters & bit) && !(attempted & bit)) openCounter(i);
+        }
+#endif
+        attempted |= counters;
+        return counters & available;
+    }
+
+    std::uint64_t read(std::size_t i) const {
+#ifdef PF_HAS_PERF_EVENTS
+#if defined(__x86_64__) || defined(__i386__)
+        // the seqlock read from the perf_event_open man page
+        if(const volatile perf_event_mmap_page* pc = pages[i]; pc && pc->cap_user_rdpmc) {
+            std::uint32_t seq;
+            std::uint64_t count;
+            do {
+                seq = pc->lock;
+                std::atomic_signal_fence(std::memory_order_seq_cst);
+                std::uint32_t index = pc->index;
+                count = pc->offset;
+                if(index) {
+                    unsigned width = 64 - pc->pmc_width;
+                    count += static_cast<std::int64_t>(__rdpmc(index - 1) << width) >> width;
+                }
+                std::atomic_signal_fence(std::memory_order_seq_cst);
+            } while(pc->lock != seq);
+            return count;
+        }
+#endif
+        std::uint64_t value = 0;
+        if(::read(fds[i], &value, sizeof(value)) != sizeof(value)) return 0;
+        return value;
+#else
+        static_cast<void>(i);
+        return 0;
+#endif
+    }
+};
+
+#ifdef PF_HAS_SAMPLER
+// statistical mode next to the timers: every sampled thread has a SIGPROF timer on its own cpu
+// time, and the handler walks the frame pointer chain into a preallocated lock free queue
+// tagged with the innermost PF_SCOPE_TIMER. the reporter thread moves the samples out, write()
+// dumps them with the executable mappings for profiler-symbolize. threads are sampled once they
+// run a scope timer after start() or call registerThread(). stacks through code built without
+// frame pointers end early, the pc of the interrupted frame is always kept
+class Sampler {
+    struct Record {
+        profilerClock::ticks time;
+        std::uint32_t thread;
+        TimerId scope;
+        std::uint32_t depth;
+        std::uintptr_t frames[PF_SAMPLER_MAX_DEPTH];
+    };
+
+    struct StoredSample {
+        profilerClock::ticks time;
+        std::uint32_t thread;
+        TimerId scope;
+        std::size_t first; // into storedFrames
+        std::uint32_t depth;
+    };
+
+    // read by the handler, so constant initialized and without a destructor
+    struct ThreadState {
+        std::uintptr_t stackLow;
+        std::uintptr_t stackHigh;
+        std::uint32_t thread;
+        std::atomic<TimerId> scope;
+        bool registered;
+    };
+
+    struct ThreadTimer {
+        ~ThreadTimer() {
+            Sampler::unregisterThread();
+        }
+    };
+
+    static inline thread_local ThreadState state = {0, 0, 0, {invalidTimerId}, false};
+
+    static std::atomic<bool> samplerRunning;
+    static std::atomic<std::uint64_t> droppedSamples;
+    static std::atomic<long> intervalNs;
+    static std::mutex samplerMutex;
+    static std::map<pid_t, timer_t> timers;
+    static std::unique_ptr<BoundedMpmcQueue<Record>> queue;
+    static std::mutex storedMutex;
+    static std::vector<StoredSample> stored;
+    static std::vector<std::uintptr_t> storedFrames;
+
+    static void handler(int, siginfo_t*, void* context) {
+        int savedErrno = errno;
+        if(samplerRunning.load(std::memory_order_relaxed) && state.registered) {
+            const ucontext_t* uc = static_cast<const ucontext_t*>(context);
+            Record r;
+            r.time = profilerClock::nowTicks();
+            r.thread = state.thread;
+            r.scope = state.scope.load(std::memory_order_relaxed);
+#if defined(__x86_64__)
+            std::uintptr_t pc = (std::uintptr_t)uc->uc_mcontext.gregs[REG_RIP];
+            std::uintptr_t fp = (std::uintptr_t)uc->uc_mcontext.gregs[REG_RBP];
+#else
+            std::uintptr_t pc = (std::uintptr_t)uc->uc_mcontext.pc;
+            std::uintptr_t fp = (std::uintptr_t)uc->uc_mcontext.regs[29];
+#endif
+            r.frames[0] = pc;
+            r.depth = 1;
+            // each frame holds the caller's frame pointer and the return address, both checked
+            // against this thread's stack before they are read
+            while(r.depth < PF_SAMPLER_MAX_DEPTH && fp % sizeof(std::uintptr_t) == 0
+                  && fp >= state.stackLow && fp + 2 * sizeof(std::uintptr_t) <= state.stackHigh) {
+                const std::uintptr_t* frame = reinterpret_cast<const std::uintptr_t*>(fp);
+                std::uintptr_t next = frame[0];
+                std::uintptr_t ret = frame[1];
+                if(ret == 0) break;
+                r.frames[r.depth++] = ret;
+                if(next <= fp) break;
+                fp = next;
+            }
+            if(!queue->tryPush(r)) droppedSamples.fetch_add(1, std::memory_order_relaxed);
+        }
+        errno = savedErrno;
+    }
+
+    // zero disarms
+    static bool armTimer(timer_t timer, long ns = intervalNs.load(std::memory_order_relaxed)) {
+        itimerspec spec{};
+        spec.it_interval.tv_sec = ns / 1000000000L;
+        spec.it_interval.tv_nsec = ns % 1000000000L;
+        spec.it_value = spec.it_interval;
+        return timer_settime(timer, 0, &spec, nullptr) == 0;
+    }
+
+    static void unregisterThread() {
+        std::lock_guard<std::mutex> lock(samplerMutex);
+        auto it = timers.find((pid_t)syscall(SYS_gettid));
+        if(it != timers.end()) {
+            timer_delete(it->second);
+            timers.erase(it);
+        }
+        state.registered = false;
+    }
+
+    static void drain() {
+        if(!queue) return;
+        std::lock_guard<std::mutex> lock(storedMutex);
+        Record r;
+        while(queue->tryPop(r)) {
+            stored.push_back({r.time, r.thread, r.scope, storedFrames.size(), r.depth});
+            storedFrames.insert(storedFrames.end(), r.frames, r.frames + r.depth);
+        }
+    }
+public:
+    static bool running() {
+        return samplerRunning.load(std::memory_order_relaxed);
+    }
+
+    // samples the calling thread from now on, false when its timer cannot be created
+    static bool registerThread() {
+        if(state.registered) return true;
+        if(!running()) return false;
+        static thread_local ThreadTimer owner;
+        pthread_attr_t attr;
+        if(pthread_getattr_np(pthread_self(), &attr) == 0) {
+            void* low = nullptr;
+            std::size_t size = 0;
+            pthread_attr_getstack(&attr, &low, &size);
+            pthread_attr_destroy(&attr);
+            state.stackLow = (std::uintptr_t)low;
+            state.stackHigh = (std::uintptr_t)low + size;
+        }
+        state.thread = currentThreadIndex();
+        pid_t tid = (pid_t)syscall(SYS_gettid);
+        sigevent event{};
+        event.sigev_notify = SIGEV_THREAD_ID;
+        event.sigev_signo = SIGPROF;
+#ifdef sigev_notify_thread_id
+        event.sigev_notify_thread_id = tid;
+#else
+        event._sigev_un._tid = tid;
+#endif
+        std::lock_guard<std::mutex> lock(samplerMutex);
+        if(!running()) return false;
+        timer_t timer;
+        if(timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &timer) != 0) return false;
+        state.registered = true;
+        if(!armTimer(timer)) {
+            timer_delete(timer);
+            state.registered = false;
+            return false;
+        }
+        timers[tid] = timer;
+        return true;
+    }
+
+    // sampling rate per thread in samples per second of that thread's cpu time, the kernel checks
+    // cpu timers on its scheduler tick so rates above CONFIG_HZ are capped there. rearms the
+    // threads registered before a stop() and registers the calling thread, false when the
+    // handler or its timer cannot be installed
+    static bool start(unsigned hz = 997) {
+        {
+            std::lock_guard<std::mutex> lock(samplerMutex);
+            if(running()) return true;
+            if(!queue) queue = std::make_unique<BoundedMpmcQueue<Record>>(PF_SAMPLER_QUEUE_CAPACITY);
+            intervalNs.store(1000000000L / std::max(1u, hz), std::memory_order_relaxed);
+            struct sigaction action{};
+            action.sa_sigaction = handler;
+            action.sa_flags = SA_SIGINFO | SA_RESTART;
+            sigemptyset(&action.sa_mask);
+            if(sigaction(SIGPROF, &action, nullptr) != 0) return false;
+            samplerRunning.store(true, std::memory_order_release);
+            for(auto& [tid, timer] : timers) armTimer(timer);
+        }
+        Reporter::addJob("sampler", [] { return defaultSamplerSleepDuration; }, drain);
+        Reporter::start();
+        return registerThread();
+    }
+
+    // disarms every thread's timer, the threads stay registered until they exit so a later
+    // start() samples them again. the samples stay until write()
+    static void stop() {
+        std::lock_guard<std::mutex> lock(samplerMutex);
+        if(!running()) return;
+        samplerRunning.store(false, std::memory_order_release);
+        for(auto& [tid, timer] : timers) armTimer(timer, 0);
+    }
+
+    static std::uint64_t dropped() {
+        return droppedSamples.load(std::memory_order_relaxed);
+    }
+
+    // innermost scope of the calling thread, returns the one it replaces
+    static TimerId enterScope(TimerId id) {
+        return state.scope.exchange(id, std::memory_order_relaxed);
+    }
+
+    static void exitScope(TimerId enclosing) {
+        state.scope.store(enclosing, std::memory_order_relaxed);
+    }
+
+    // writes the samples taken so far in the text format profiler-symbolize reads, and forgets them
+    static void write(std::ostream& out) {
+        drain();
+        std::lock_guard<std::mutex> lock(storedMutex);
+        out << "# profiler samples 1\n";
+        double nsPerTick = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(profilerClock::toDuration(1000000)).count() / 1e6;
+        out << "interval_ns " << intervalNs.load(std::memory_order_relaxed) << "\nns_per_tick " << std::setprecision(15) << nsPerTick << "\n";
+        out << "dropped " << dropped() << "\n";
+        std::ifstream maps("/proc/self/maps");
+        for(std::string line; std::getline(maps, line);) {
+            std::istringstream fields(line);
+            std::string range, perms, offset, device, inode, path;
+            fields >> range >> perms >> offset >> device >> inode;
+            std::getline(fields >> std::ws, path);
+            if(perms.size() < 3 || perms[2] != 'x' || path.empty() || path[0] != '/') continue;
+            std::size_t dash = range.find('-');
+            out << "map " << range.substr(0, dash) << " " << range.substr(dash + 1) << " " << offset << " " << path << "\n";
+        }
+        std::vector<bool> named;
+        for(auto& sample : stored) {
+            if(sample.scope == invalidTimerId) continue;
+            if(sample.scope >= named.size()) named.resize(sample.scope + 1);
+            if(named[sample.scope]) continue;
+            named[sample.scope] = true;
+            out << "scope " << sample.scope << " " << TimerRegistry::name(sample.scope) << "\n";
+        }
+        out << std::hex;
+        for(auto& sample : stored) {
+            out << "sample " << std::dec << sample.thread << " " << sample.time << " ";
+            if(sample.scope == invalidTimerId) out << "-";
+            else out << sample.scope;
+            out << std::hex;
+            for(std::uint32_t i = 0; i < sample.depth; i++) out << " " << storedFrames[sample.first + i];
+            out << "\n";
+        }
+        out << std::dec;
+        stored.clear();
+        storedFrames.clear();
+    }
+
+    static bool write(const std::string& path) {
+        std::ofstream file(path);
+        if(!file) {
+            std::cerr << "could not open sample file " << path << "\n";
+            return false;
+        }
+        write(file);
+        return (bool)file;
+    }
+
+    struct Stopper {
+        ~Stopper() { Sampler::stop(); }
+    };
+    static Stopper stopper;
+};
+std::atomic<bool> Sampler::samplerRunning{false};
+std::atomic<std::uint64_t> Sampler::droppedSamples{0};
+std::atomic<long> Sampler::intervalNs{0};
+std::mutex Sampler::samplerMutex;
+std::map<pid_t, timer_t> Sampler::timers;
+std::unique_ptr<BoundedMpmcQueue<Sampler::Record>> Sampler::queue;
+std::mutex Sampler::storedMutex;
+std::vector<Sampler::StoredSample> Sampler::stored;
+std::vector<std::uintptr_t> Sampler::storedFrames;
+Sampler::Stopper Sampler::stopper;
+#endif
+
+class AverageTimer {
+    TimerId id;
+    std::uint32_t weight = 1;
+    AllocationScope allocations;
+    Timer t;
+
+    void start() {
+        allocations.enter();
+        t.start();
+    }
+public:
+    AverageTimer(TimerId _id) : id(_id), weight(ProbeFilter::enabled(_id)) {
+        if(weight) start();
+    }
+    AverageTimer(const TimerHandle& handle) : id(handle.id), weight(ProbeFilter::enabled(handle.id)) {
+        if(weight) start();
+    }
+    // only times the calls the sampler picks, each standing in for the calls it skipped
+    AverageTimer(const TimerHandle& handle, SiteSampler& sampler) : id(handle.id), weight(ProbeFilter::enabled(handle.id) ? sampler.sample() : 0) {
+        if(weight) start();
+    }
+    AverageTimer(const char* _id) : AverageTimer(TimerRegistry::registerTimer(_id)) {}
+    ~AverageTimer() {
+        if(!weight) return;
+        profilerClock::ticks d = t.stopTicks();
+        AllocationCounts a = allocations.exit();
+        UntrackedAllocations untracked;
+        logBinaryRecord(id, t.startedAt(), d);
+        FrameTracker::record(id, d);
+        AverageTimerManager::addAverageTime(id, d, weight, a);
+    }
+};
+
+class ScopeTimer {
+    const char* id;
+    TimerId slot = invalidTimerId;
+    bool active;
+    bool inCallTree = false;
+#ifdef PF_HAS_SAMPLER
+    bool sampled = false;
+    TimerId enclosingScope = invalidTimerId;
+#endif
+    AllocationScope allocations;
+    Timer t;
+
+    void enterCallTree() {
+        if(!CallTree::enabled()) return;
+        if(slot == invalidTimerId) slot = TimerRegistry::registerTimer(id);
+        CallTree::local().enter(slot, id);
+        inCallTree = true;
+    }
+
+    void enterSampler() {
+#ifdef PF_HAS_SAMPLER
+        if(!Sampler::running() || !Sampler::registerThread()) return;
+        if(slot == invalidTimerId) slot = TimerRegistry::registerTimer(id);
+        enclosingScope = Sampler::enterScope(slot);
+        sampled = true;
+#endif
+    }
+public:
+    ScopeTimer(const TimerHandle& handle) : id(handle.name), slot(handle.id), active(ProbeFilter::enabled(handle.id)) {
+        if(!active) return;
+        {
+            UntrackedAllocations untracked;
+            enterCallTree();
+            enterSampler();
+        }
+        allocations.enter();
+        t.start();
+    }
+    // names are only resolved to ids when needed, so only the global switch applies
+    ScopeTimer(const char* _id) : id(_id), active(ProbeFilter::enabled()) {
+        if(!active) return;
+        {
+            UntrackedAllocations untracked;
+            enterCallTree();
+            enterSampler();
+        }
+        allocations.enter();
+        t.start();
+    }
+    ~ScopeTimer() {
+        if(!active) return;
+        profilerClock::ticks end = profilerClock::nowTicks();
+        profilerClock::ticks elapsed = ProbeOverhead::corrected(end - t.startedAt());
+#ifdef PF_HAS_SAMPLER
+        if(sampled) Sampler::exitScope(enclosingScope);
+#endif
+        [[maybe_unused]] AllocationCounts a = allocations.exit();
+        UntrackedAllocations untracked;
+        if(FrameTracker::recording()) {
+            if(slot == invalidTimerId) slot = TimerRegistry::registerTimer(id);
+            FrameTracker::record(slot, elapsed);
+        }
+        bool recorded = false;
+        if(inCallTree) {
+            CallTree::local().exit(elapsed);
+            recorded = true;
+        }
+        if(Tracer::enabled()) {
+            Tracer::record(id, t.startedAt(), end);
+            recorded = true;
+        }
+#ifdef PF_HAS_BINARY_LOG
+        if(BinaryLog::active()) {
+            if(slot == invalidTimerId) slot = TimerRegistry::registerTimer(id);
+            BinaryLog::write(slot, t.startedAt(), elapsed);
+            recorded = true;
+        }
+#endif
+        if(recorded) return;
+        if(AsyncOutput::enabled()) {
+            AsyncOutput::push(id, elapsed);
+            return;
+        }
+        defaultProfilerOutputFunction(id, profilerClock::toDuration(elapsed));
+#ifdef PF_TRACK_ALLOCATIONS
+        defaultAllocationOutputFunction(id, a, 1);
+#endif
+    }
+};
+
+// wall time plus hardware counter deltas, aggregated per id and reported like the average timers.
+// counters that cannot be opened on this machine are left out of the report
+class PerfScope {
+    TimerId id;
+    bool active;
+    std::uint32_t mask = 0;
+    std::uint64_t begin[perfCounterCount] = {};
+    Timer t;
+public:
+    PerfScope(const TimerHandle& handle, std::uint32_t counters = counters::PERF_ALL)
+        : id(handle.id), active(ProbeFilter::enabled(handle.id)) {
+        if(!active) return;
+        mask = PerfEvents::local().open(counters);
+        PerfEvents& events = PerfEvents::local();
+        for(std::size_t i = 0; i < perfCounterCount; i++) if(mask & (1u << i)) begin[i] = events.read(i);
+        t.start();
+    }
+    PerfScope(const char* _id, std::uint32_t counters = counters::PERF_ALL)
+        : PerfScope(TimerHandle{TimerRegistry::registerTimer(_id), _id}, counters) {}
+    ~PerfScope() {
+        if(!active) return;
+        profilerClock::ticks d = t.stopTicks();
+        PerfEvents& events = PerfEvents::local();
+        std::uint64_t deltas[perfCounterCount] = {};
+        for(std::size_t i = 0; i < perfCounterCount; i++) if(mask & (1u << i)) deltas[i] = events.read(i) - begin[i];
+        UntrackedAllocations untracked;
+        FrameTracker::record(id, d);
+        AverageTimerManager::addPerfSample(id, d, mask, deltas);
+    }
+};
+
+class CumulativeTimer {
+    TimerId id;
+    std::uint32_t weight = 1;
+    Timer t;
+public:
+    CumulativeTimer(TimerId _id) : id(_id), weight(ProbeFilter::enabled(_id)) {
+        if(weight) t.start();
+    }
+    CumulativeTimer(const TimerHandle& handle) : id(handle.id), weight(ProbeFilter::enabled(handle.id)) {
+        if(weight) t.start();
+    }
+    // only times the calls the sampler picks, each standing in for the calls it skipped
+    CumulativeTimer(const TimerHandle& handle, SiteSampler& sampler) : id(handle.id), weight(ProbeFilter::enabled(handle.id) ? sampler.sample() : 0) {
+        if(weight) t.start();
+    }
+    CumulativeTimer(const char* _id) : CumulativeTimer(TimerRegistry::registerCumulativeTimer(_id)) {}
+    ~CumulativeTimer() {
+        if(!weight) return;
+        profilerClock::ticks d = t.stopTicks();
+        UntrackedAllocations untracked;
+        logBinaryRecord(id, t.startedAt(), d);
+        FrameTracker::record(id, d);
+        AverageTimerManager::addCumulativeTime(id, d, weight);
+    }
+};
+
+class HistogramTimer {
+    TimerId id;
+    std::uint32_t weight = 1;
+    Timer t;
+public:
+    HistogramTimer(TimerId _id) : id(_id), weight(ProbeFilter::enabled(_id)) {
+        if(weight) t.start();
+    }
+    HistogramTimer(const TimerHandle& handle) : id(handle.id), weight(ProbeFilter::enabled(handle.id)) {
+        if(weight) t.start();
+    }
+    // only times the calls the sampler picks, each standing in for the calls it skipped
+    HistogramTimer(const TimerHandle& handle, SiteSampler& sampler) : id(handle.id), weight(ProbeFilter::enabled(handle.id) ? sampler.sample() : 0) {
+        if(weight) t.start();
+    }
+    HistogramTimer(const char* _id) : HistogramTimer(TimerRegistry::registerTimer(_id)) {}
+    ~HistogramTimer() {
+        if(!weight) return;
+        profilerClock::ticks d = t.stopTicks();
+        UntrackedAllocations untracked;
+        logBinaryRecord(id, t.startedAt(), d);
+        FrameTracker::record(id, d);
+        AverageTimerManager::addHistogramTime(id, d, weight);
+    }
+};
+
+// times the scope like a cumulative timer and reports the items it handled per second and
+// the time per item
+class ThroughputTimer {
+    TimerId id;
+    std::int64_t items;
+    bool active;
+    Timer t;
+public:
+    ThroughputTimer(const TimerHandle& handle, std::int64_t _items) : id(handle.id), items(_items), active(ProbeFilter::enabled(handle.id)) {
+        if(active) t.start();
+    }
+    ThroughputTimer(const char* _id, std::int64_t _items) : ThroughputTimer(TimerHandle{Instruments::registerThroughput(_id), _id}, _items) {}
+    ~ThroughputTimer() {
+        if(!active) return;
+        profilerClock::ticks d = t.stopTicks();
+        UntrackedAllocations untracked;
+        logBinaryRecord(id, t.startedAt(), d);
+        FrameTracker::record(id, d);
+        Instruments::addThroughput(id, items, d);
+    }
+};
+
+// times empty probes of every kind on the calling thread and hands the costs to ProbeOverhead.
+// the average, cumulative and histogram timers go through the real managers under their own
+// ids, which are discarded afterwards, the call tree scope runs against a scratch tree. run it
+// before opening a binary log, starting a frame or enabling the cpu breakdown, those would see
+// the calibration samples, and again after PF_SET_PROFILER_CLOCK
+class Calibration {
+    static constexpr std::size_t rounds = 7;
+    static constexpr std::size_t callsPerRound = 2000;
+    static constexpr std::size_t clockSamples = 10001;
+
+    // the fastest round, anything slower was interrupted
+    template <typename F>
+    static profilerClock::ticks perCall(F&& probe) {
+        profilerClock::ticks best = std::numeric_limits<profilerClock::ticks>::max();
+        for(std::size_t r = 0; r < rounds; r++) {
+            profilerClock::ticks begin = profilerClock::nowTicks();
+            for(std::size_t i = 0; i < callsPerRound; i++) probe();
+            best = std::min(best, profilerClock::nowTicks() - begin);
+        }
+        return (best + (profilerClock::ticks)callsPerRound / 2) / (profilerClock::ticks)callsPerRound;
+    }
+
+    static profilerClock::ticks clockCost() {
+        std::vector<profilerClock::ticks> samples(clockSamples);
+        for(auto& sample : samples) {
+            Timer t;
+            t.start();
+            sample = t.stopTicks();
+        }
+        std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+        return samples[samples.size() / 2];
+    }
+
+    // what a ScopeTimer does in call tree mode, without the sampler and frame hooks
+    static profilerClock::ticks callTreeScopeCost(TimerId id, const char* name) {
+        ThreadCallTree scratch;
+        return perCall([&] {
+            scratch.enter(id, name);
+            AllocationScope allocations;
+            allocations.enter();
+            Timer t;
+            t.start();
+            profilerClock::ticks end = profilerClock::nowTicks();
+            allocations.exit();
+            scratch.exit(end - t.startedAt());
+        });
+    }
+public:
+    static ProbeCosts run() {
+        const char* name = "profiler calibration";
+        bool subtracting = ProbeOverhead::subtracting();
+        ProbeOverhead::subtract(false);
+        TimerId id = TimerRegistry::registerTimer(name);
+        TimerId cumulativeId = TimerRegistry::registerCumulativeTimer(name);
+        // measured with the probes on, a filter or PF_PROFILE=0 would time the disabled path
+        ProbeFilter::pin(id);
+        ProbeFilter::pin(cumulativeId);
+        ProbeCosts c;
+        c.clock = clockCost();
+        c.average = perCall([id] { AverageTimer t(id); });
+        c.cumulative = perCall([cumulativeId] { CumulativeTimer t(cumulativeId); });
+        c.histogram = perCall([id] { HistogramTimer t(id); });
+        c.callTreeScope = callTreeScopeCost(id, name);
+        ProbeFilter::pin(id, false);
+        ProbeFilter::pin(cumulativeId, false);
+        AverageTimerManager::discard(id);
+        AverageTimerManager::discard(cumulativeId);
+        ProbeOverhead::set(c);
+        ProbeOverhead::subtract(subtracting);
+        return c;
+    }
+
+    // calibrates first if nothing was measured yet
+    static void enableSubtraction(bool on = true) {
+        if(on && !ProbeOverhead::costs()) run();
+        ProbeOverhead::subtract(on);
+    }
+
+    static void report() {
+        std::optional<ProbeCosts> c = ProbeOverhead::costs();
+        defaultProbeOverheadOutputFunction(c ? *c : run());
+    }
+
+    // PF_PROFILE_OVERHEAD=subtract calibrates and subtracts from the start, report prints the
+    // costs as well, both can be given separated by a comma
+    static void readEnvironment() {
+        const char* overhead = std::getenv("PF_PROFILE_OVERHEAD");
+        if(!overhead) return;
+        std::string_view v = overhead;
+        if(v.find("subtract") != std::string_view::npos) enableSubtraction();
+        if(v.find("report") != std::string_view::npos) report();
+    }
+
+    struct Initializer {
+        Initializer() { Calibration::readEnvironment(); }
+    };
+    static Initializer initializer;
+};
+
+inline std::atomic<std::uint64_t> nextTaskId{1};
+
+inline std::uint64_t newTaskId() {
+    return nextTaskId.fetch_add(1, std::memory_order_relaxed);
+}
+
+struct AsyncScopeIds {
+    TimerId running;
+    TimerId waiting;
+    TimerId migrations;
+};
+
+// a timed region of a logical task that can suspend on one thread and resume on another, for
+// coroutines and callback chains where a ScopeTimer would count the suspension as work and
+// its thread local state would not follow the task. awaiters call suspend() before handing the
+// task off and resume() where it continues (timedAwait does both). running time goes to the
+// average timer "<name>", suspended time to "<name> waiting", resumes on another thread to the
+// counter "<name> migrations", and while tracing every running slice is traced with its task id.
+// scopes of one task pass the same task id. the scope must only be touched by the thread that
+// currently runs the task
+class AsyncScope {
+    AsyncScopeIds ids;
+    const char* name;
+    std::uint64_t taskId;
+    bool active; // decided once, a task switched off halfway would report half its time
+    std::uint32_t thread = currentThreadIndex();
+    bool suspended = false;
+    bool everSuspended = false; // a task that never waited adds no waiting sample
+    profilerClock::ticks sliceStart = active ? profilerClock::nowTicks() : 0;
+    profilerClock::ticks suspendedAt = 0;
+    profilerClock::ticks running = 0;
+    profilerClock::ticks waiting = 0;
+
+    void endSlice(profilerClock::ticks now) {
+        running += now - sliceStart;
+        if(Tracer::enabled()) Tracer::record(name, sliceStart, now, taskId);
+    }
+public:
+    static AsyncScopeIds registerIds(const char* name) {
+        return {TimerRegistry::registerTimer(name), TimerRegistry::registerTimer(name, " waiting"),
+                Instruments::registerCounter(name, " migrations")};
+    }
+
+    AsyncScope(const AsyncScopeIds& _ids, const char* _name, std::uint64_t task = newTaskId())
+        : ids(_ids), name(_name), taskId(task), active(ProbeFilter::enabled(_ids.running)) {}
+    AsyncScope(const char* _name, std::uint64_t task = newTaskId()) : AsyncScope(registerIds(_name), _name, task) {}
+    AsyncScope(const AsyncScope&) = delete;
+    AsyncScope& operator=(const AsyncScope&) = delete;
+
+    // the profiler's own buffers growing here is not charged to the scopes around the task
+    ~AsyncScope() {
+        if(!active) return;
+        if(suspended) resume();
+        profilerClock::ticks now = profilerClock::nowTicks();
+        UntrackedAllocations untracked;
+        endSlice(now);
+        AverageTimerManager::addAverageTime(ids.running, running);
+        if(everSuspended) AverageTimerManager::addAverageTime(ids.waiting, waiting);
+    }
+
+    void suspend() {
+        if(!active || suspended) return;
+        profilerClock::ticks now = profilerClock::nowTicks();
+        UntrackedAllocations untracked;
+        endSlice(now);
+        suspendedAt = now;
+        suspended = true;
+        everSuspended = true;
+    }
+
+    void resume() {
+        if(!active || !suspended) return;
+        profilerClock::ticks now = profilerClock::nowTicks();
+        UntrackedAllocations untracked;
+        waiting += now - suspendedAt;
+        std::uint32_t current = currentThreadIndex();
+        if(current != thread) Instruments::add(ids.migrations, 1);
+        thread = current;
+        sliceStart = now;
+        suspended = false;
+    }
+
+    std::uint64_t task() const {
+        return taskId;
+    }
+};
+
+// stands in for an AsyncScope when PF_ENABLED is 0, so awaiters keep compiling
+struct NullAsyncScope {
+    template <typename... Args>
+    explicit NullAsyncScope(Args&&...) {}
+    void suspend() {}
+    void resume() {}
+    std::uint64_t task() const { return 0; }
+};
+
+// wraps an awaiter so the scope is suspended while the coroutine waits on it. written against
+// the awaiter protocol only, so the header does not need <coroutine>
+template <typename ScopeT, typename AwaiterT>
+class TimedAwaiter {
+    ScopeT& scope;
+    AwaiterT inner;
+public:
+    TimedAwaiter(ScopeT& _scope, AwaiterT&& _inner) : scope(_scope), inner(std::forward<AwaiterT>(_inner)) {}
+
+    bool await_ready() {
+        return inner.await_ready();
+    }
+
+    // suspended before the inner awaiter can hand the coroutine to another thread
+    template <typename HandleT>
+    decltype(auto) await_suspend(HandleT handle) {
+        scope.suspend();
+        return inner.await_suspend(handle);
+    }
+
+    decltype(auto) await_resume() {
+        scope.resume();
+        return inner.await_resume();
+    }
+};
+
+template <typename ScopeT, typename AwaiterT>
+TimedAwaiter<ScopeT, AwaiterT> timedAwait(ScopeT& scope, AwaiterT&& awaiter) {
+    return TimedAwaiter<ScopeT, AwaiterT>(scope, std::forward<AwaiterT>(awaiter));
+}
+
+// drop in for a mutex that tells waiting apart from working. "<name> wait" and "<name> hold"
+// are histogram timers, "<name> contended" counts the acquisitions that had to wait. the
+// uncontended path is one try_lock and a clock read, nothing else touches the mutex. wait and
+// hold times go through the calling thread's ring, so unrelated mutexes don't meet on a lock
+template <typename MutexT>
+class BasicProfiledMutex {
+    MutexT m;
+    TimerId waitId;
+    TimerId holdId;
+    TimerId contendedId;
+    profilerClock::ticks lockedAt = 0; // only written and read by the owner, 0 while hold is off
+
+    void waited(profilerClock::ticks begin, profilerClock::ticks acquired) {
+        AverageTimerManager::addLocalHistogramTime(waitId, acquired - begin);
+        Instruments::add(contendedId, 1);
+    }
+
+    void acquired() {
+        lockedAt = ProbeFilter::enabled(holdId) ? profilerClock::nowTicks() : 0;
+    }
+public:
+    explicit BasicProfiledMutex(std::string_view name = "mutex")
+        : waitId(TimerRegistry::registerTimer(name, " wait")),
+          holdId(TimerRegistry::registerTimer(name, " hold")),
+          contendedId(Instruments::registerCounter(name, " contended")) {}
+    BasicProfiledMutex(const BasicProfiledMutex&) = delete;
+    BasicProfiledMutex& operator=(const BasicProfiledMutex&) = delete;
+
+    void lock() {
+        if(m.try_lock()) {
+            acquired();
+            return;
+        }
+        if(!ProbeFilter::enabled(waitId)) {
+            m.lock();
+            acquired();
+            return;
+        }
+        profilerClock::ticks begin = profilerClock::nowTicks();
+        m.lock();
+        profilerClock::ticks at = profilerClock::nowTicks();
+        lockedAt = ProbeFilter::enabled(holdId) ? at : 0;
+        waited(begin, at);
+    }
+
+    bool try_lock() {
+        if(!m.try_lock()) return false;
+        acquired();
+        return true;
+    }
+
+    void unlock() {
+        if(lockedAt == 0) {
+            m.unlock();
+            return;
+        }
+        profilerClock::ticks held = profilerClock::nowTicks() - lockedAt;
+        m.unlock();
+        AverageTimerManager::addLocalHistogramTime(holdId, held);
+    }
+
+    MutexT& native() {
+        return m;
+    }
+};
+
+// the shared side is reported as "<name> shared wait", "<name> shared hold" and "<name> shared
+// contended". readers keep their acquisition times in a small per thread table, a thread holding
+// more than sharedHoldSlots shared locks at once leaves the extra hold times out
+template <typename SharedMutexT>
+class BasicProfiledSharedMutex : public BasicProfiledMutex<SharedMutexT> {
+    static constexpr std::size_t sharedHoldSlots = 8;
+
+    struct SharedHold {
+        const void* mutex;
+        profilerClock::ticks lockedAt;
+    };
+
+    struct SharedHolds {
+        SharedHold holds[sharedHoldSlots];
+        std::size_t size = 0;
+    };
+
+    TimerId sharedWaitId;
+    TimerId sharedHoldId;
+    TimerId sharedContendedId;
+
+    static SharedHolds& holds() {
+        thread_local SharedHolds h;
+        return h;
+    }
+
+    void acquiredShared(profilerClock::ticks at) {
+        SharedHolds& h = holds();
+        if(h.size < sharedHoldSlots) h.holds[h.size++] = {this, at};
+    }
+
+    // a shared lock taken while hold is off leaves no entry, so its unlock finds nothing to report
+    void acquiredShared() {
+        if(ProbeFilter::enabled(sharedHoldId)) acquiredShared(profilerClock::nowTicks());
+    }
+public:
+    explicit BasicProfiledSharedMutex(std::string_view name = "shared mutex")
+        : BasicProfiledMutex<SharedMutexT>(name),
+          sharedWaitId(TimerRegistry::registerTimer(name, " shared wait")),
+          sharedHoldId(TimerRegistry::registerTimer(name, " shared hold")),
+          sharedContendedId(Instruments::registerCounter(name, " shared contended")) {}
+
+    void lock_shared() {
+        if(this->native().try_lock_shared()) {
+            acquiredShared();
+            return;
+        }
+        if(!ProbeFilter::enabled(sharedWaitId)) {
+            this->native().lock_shared();
+            acquiredShared();
+            return;
+        }
+        profilerClock::ticks begin = profilerClock::nowTicks();
+        this->native().lock_shared();
+        profilerClock::ticks acquired = profilerClock::nowTicks();
+        if(ProbeFilter::enabled(sharedHoldId)) acquiredShared(acquired);
+        AverageTimerManager::addLocalHistogramTime(sharedWaitId, acquired - begin);
+        Instruments::add(sharedContendedId, 1);
+    }
+
+    bool try_lock_shared() {
+        if(!this->native().try_lock_shared()) return false;
+        acquiredShared();
+        return true;
+    }
+
+    void unlock_shared() {
+        SharedHolds& h = holds();
+        if(h.size == 0) {
+            this->native().unlock_shared();
+            return;
+        }
+        profilerClock::ticks now = profilerClock::nowTicks();
+        this->native().unlock_shared();
+        for(std::size_t i = h.size; i-- > 0;) {
+            if(h.holds[i].mutex != this) continue;
+            profilerClock::ticks held = now - h.holds[i].lockedAt;
+            h.holds[i] = h.holds[--h.size];
+            AverageTimerManager::addLocalHistogramTime(sharedHoldId, held);
+            return;
+        }
+    }
+};
+
+// takes and ignores the name, so a build with PF_ENABLED 0 keeps compiling unchanged
+template <typename MutexT>
+struct UnprofiledMutex : MutexT {
+    explicit UnprofiledMutex(std::string_view = {}) {}
+};
+
+#if PF_ENABLED
+using ProfiledMutex = BasicProfiledMutex<std::mutex>;
+using ProfiledSharedMutex = BasicProfiledSharedMutex<std::shared_mutex>;
+#else
+using ProfiledMutex = UnprofiledMutex<std::mutex>;
+using ProfiledSharedMutex = UnprofiledMutex<std::shared_mutex>;
+#endif
+
+namespace categories {
+inline constexpr std::uint64_t CAT_DEFAULT = 1ull << 0;
+inline constexpr std::uint64_t CAT_IO      = 1ull << 1;
+inline constexpr std::uint64_t CAT_NETWORK = 1ull << 2;
+inline constexpr std::uint64_t CAT_COMPUTE = 1ull << 3;
+inline constexpr std::uint64_t CAT_MEMORY  = 1ull << 4;
+inline constexpr std::uint64_t CAT_SYNC    = 1ull << 5;
+inline constexpr std::uint64_t CAT_RENDER  = 1ull << 6;
+inline constexpr std::uint64_t CAT_ALL     = ~0ull;
+}
+
+constexpr bool categoryEnabled(std::uint64_t category) {
+    return PF_ENABLED && (category & (std::uint64_t)(PF_CATEGORY_MASK)) != 0;
+}
+
+// stands in for a timer of a compiled out category, the optimizer removes it entirely
+struct NullProbe {
+    template <typename... Args>
+    constexpr explicit NullProbe(Args&&...) {}
+};
+
+template <bool enabled, typename ProbeT>
+struct CategoryProbeSelector {
+    using type = ProbeT;
+};
+
+template <typename ProbeT>
+struct CategoryProbeSelector<false, ProbeT> {
+    using type = NullProbe;
+};
+
+template <bool enabled, typename ProbeT>
+using CategoryProbe = typename CategoryProbeSelector<enabled, ProbeT>::type;
+
+template <bool enabled>
+TimerHandle makeTimerHandle(const char* name, TimerId (*registration)(std::string_view)) {
+    if constexpr(enabled) return {registration(name), TimerRegistry::keep(name)};
+    else return {invalidTimerId, nullptr};
+}
+
+// the handle a call site runs with: its static one for a stable name, otherwise name looked up
+// again on this call. the caller's string outlives the probe, so it needs no copy
+template <bool enabled, bool stable>
+TimerHandle siteTimerHandle(const TimerHandle& site, const char* name, TimerId (*registration)(std::string_view)) {
+    if constexpr(enabled && !stable) return {registration(name), name};
+    else return site;
+}
+
+// defined after every other static so it is destroyed first, while the report jobs still work
+Calibration::Initializer Calibration::initializer;
+Reporter::Stopper Reporter::stopper;
+
+}
+
+#ifdef PF_TRACK_ALLOCATIONS
+// PF_TRACK_MALLOC also interposes malloc, calloc and realloc on glibc, so C allocations are
+// charged too. operator new then allocates through glibc directly to count every allocation once
+#if defined(PF_TRACK_MALLOC) && defined(__GLIBC__)
+extern "C" {
+void* __libc_malloc(std::size_t);
+void* __libc_calloc(std::size_t, std::size_t);
+void* __libc_realloc(void*, std::size_t);
+
+void* malloc(std::size_t size) {
+    profiler::chargeAllocation(size);
+    return __libc_malloc(size);
+}
+
+// a count times size that overflows is failed by glibc, so it is not charged
+void* calloc(std::size_t n, std::size_t size) {
+    std::size_t bytes;
+    if(!__builtin_mul_overflow(n, size, &bytes)) profiler::chargeAllocation(bytes);
+    return __libc_calloc(n, size);
+}
+
+// charged with the full reallocated size once it succeeds, realloc(p, 0) frees and is not charged
+void* realloc(void* p, std::size_t size) {
+    void* result = __libc_realloc(p, size);
+    if(result && size != 0) profiler::chargeAllocation(size);
+    return result;
+}
+}
+
+namespace profiler {
+inline void* untrackedMalloc(std::size_t size) noexcept { return __libc_malloc(size); }
+}
+#else
+namespace profiler {
+inline void* untrackedMalloc(std::size_t size) noexcept { return std::malloc(size); }
+}
+#endif
+
+namespace profiler {
+inline void* trackedNew(std::size_t size) noexcept {
+    chargeAllocation(size);
+    return untrackedMalloc(size ? size : 1);
+}
+
+inline void* trackedNew(std::size_t size, std::align_val_t align) noexcept {
+    chargeAllocation(size);
+    std::size_t alignment = static_cast<std::size_t>(align);
+    // aligned_alloc wants a multiple of the alignment
+    return std::aligned_alloc(alignment, (std::max<std::size_t>(size, 1) + alignment - 1) / alignment * alignment);
+}
+
+// kept out of line, inlined into a delete expression the compiler would see free() on memory from new
+[[gnu::noinline]] inline void trackedDelete(void* p) noexcept {
+    std::free(p);
+}
+}
+
+void* operator new(std::size_t size) {
+    if(void* p = profiler::trackedNew(size)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    if(void* p = profiler::trackedNew(size)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return profiler::trackedNew(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return profiler::trackedNew(size); }
+
+void* operator new(std::size_t size, std::align_val_t align) {
+    if(void* p = profiler::trackedNew(size, align)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t align) {
+    if(void* p = profiler::trackedNew(size, align)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { profiler::trackedDelete(p); }
+void operator delete[](void* p) noexcept { profiler::trackedDelete(p); }
+void operator delete(void* p, std::size_t) noexcept { profiler::trackedDelete(p); }
+void operator delete[](void* p, std::size_t) noexcept { profiler::trackedDelete(p); }
+void operator delete(void* p, std::align_val_t) noexcept { profiler::trackedDelete(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { profiler::trackedDelete(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { profiler::trackedDelete(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { profiler::trackedDelete(p); }
+#endif
+
+#define CONCAT2(a, b) a##b
+#define CONCAT(a, b) CONCAT2(a, b)
+
+#define PF_ENABLE_AVERAGE_TIMER_AUTO_LOG() profiler::AverageTimerManager::startAverageLoggingThread()
+#define PF_ENABLE_CUMULATIVE_TIMER_AUTO_LOG() profiler::AverageTimerManager::startCumulativeLoggingThread()
+#define PF_ENABLE_HISTOGRAM_TIMER_AUTO_LOG() profiler::AverageTimerManager::startHistogramLoggingThread()
+#define PF_ENABLE_PERF_AUTO_LOG() profiler::AverageTimerManager::startPerfLoggingThread()
+#define PF_ENABLE_FRAME_AUTO_LOG() profiler::FrameTracker::startLoggingThread()
+#define PF_ENABLE_INSTRUMENT_AUTO_LOG() profiler::Instruments::startLoggingThread()
+
+// a category is any constant expression, the names in profiler::categories can be used unqualified
+#define PF_DETAIL_CATEGORY_ENABLED(cat) \
+    profiler::categoryEnabled([] { using namespace profiler::categories; return (std::uint64_t)(cat); }())
+
+// declares the enabled flag and static handle of a call site, a name that is not stable is
+// not evaluated here so it runs once per call
+#define PF_DETAIL_SITE(cat, var, registration, x) \
+    static constexpr bool CONCAT(var##enabled_, __LINE__) = PF_DETAIL_CATEGORY_ENABLED(cat); \
+    static constexpr bool CONCAT(var##stable_, __LINE__) = profiler::stableName<decltype((x))>; \
+    static const profiler::TimerHandle CONCAT(var##handle_, __LINE__) = CONCAT(var##stable_, __LINE__) \
+        ? profiler::makeTimerHandle<CONCAT(var##enabled_, __LINE__)>(x, registration) : profiler::TimerHandle{}
+
+#define PF_DETAIL_SITE_HANDLE(var, registration, x) \
+    profiler::siteTimerHandle<CONCAT(var##enabled_, __LINE__), CONCAT(var##stable_, __LINE__)>(CONCAT(var##handle_, __LINE__), x, registration)
+
+#define PF_DETAIL_TIMER(cat, timerT, var, registration, x) \
+    PF_DETAIL_SITE(cat, var, registration, x); \
+    profiler::CategoryProbe<CONCAT(var##enabled_, __LINE__), timerT> CONCAT(var##_, __LINE__)(PF_DETAIL_SITE_HANDLE(var, registration, x))
+
+#define PF_DETAIL_SAMPLED_TIMER(cat, timerT, var, registration, x, policy) \
+    PF_DETAIL_SITE(cat, var, registration, x); \
+    static thread_local profiler::SiteSampler CONCAT(var##sampler_, __LINE__)(policy); \
+    profiler::CategoryProbe<CONCAT(var##enabled_, __LINE__), timerT> CONCAT(var##_, __LINE__)(PF_DETAIL_SITE_HANDLE(var, registration, x), CONCAT(var##sampler_, __LINE__))
+
+#if PF_ENABLED
+#define PF_AVERAGE_TIMER_SAMPLED_CAT(cat, x, policy) PF_DETAIL_SAMPLED_TIMER(cat, profiler::AverageTimer, averagetimer, &profiler::TimerRegistry::registerTimer, x, policy)
+#define PF_CUMULATIVE_TIMER_SAMPLED_CAT(cat, x, policy) PF_DETAIL_SAMPLED_TIMER(cat, profiler::CumulativeTimer, cumulativetimer, &profiler::TimerRegistry::registerCumulativeTimer, x, policy)
+#define PF_HISTOGRAM_TIMER_SAMPLED_CAT(cat, x, policy) PF_DETAIL_SAMPLED_TIMER(cat, profiler::HistogramTimer, histogramtimer, &profiler::TimerRegistry::registerTimer, x, policy)
+#define PF_SCOPE_TIMER_CAT(cat, x) PF_DETAIL_TIMER(cat, profiler::ScopeTimer, scopetimer, &profiler::TimerRegistry::registerTimer, x)
+#define PF_AVERAGE_TIMER_CAT(cat, x) PF_DETAIL_TIMER(cat, profiler::AverageTimer, averagetimer, &profiler::TimerRegistry::registerTimer, x)
+#define PF_CUMULATIVE_TIMER_CAT(cat, x) PF_DETAIL_TIMER(cat, profiler::CumulativeTimer, cumulativetimer, &profiler::TimerRegistry::registerCumulativeTimer, x)
+#define PF_HISTOGRAM_TIMER_CAT(cat, x) PF_DETAIL_TIMER(cat, profiler::HistogramTimer, histogramtimer, &profiler::TimerRegistry::registerTimer, x)
+#else
+#define PF_AVERAGE_TIMER_SAMPLED_CAT(cat, x, policy) static_cast<void>(0)
+#define PF_CUMULATIVE_TIMER_SAMPLED_CAT(cat, x, policy) static_cast<void>(0)
+#define PF_HISTOGRAM_TIMER_SAMPLED_CAT(cat, x, policy) static_cast<void>(0)
+#define PF_SCOPE_TIMER_CAT(cat, x) static_cast<void>(0)
+#define PF_AVERAGE_TIMER_CAT(cat, x) static_cast<void>(0)
+#define PF_CUMULATIVE_TIMER_CAT(cat, x) static_cast<void>(0)
+#define PF_HISTOGRAM_TIMER_CAT(cat, x) static_cast<void>(0)
+#endif
+
+#define PF_DETAIL_PERF_COUNTERS(...) \
+    [] { using namespace profiler::counters; return profiler::perfCounterMask(__VA_ARGS__); }()
+
+#define PF_DETAIL_PERF_SCOPE(cat, x, mask) \
+    PF_DETAIL_SITE(cat, perfscope, &profiler::TimerRegistry::registerTimer, x); \
+    profiler::CategoryProbe<CONCAT(perfscopeenabled_, __LINE__), profiler::PerfScope> \
+        CONCAT(perfscope_, __LINE__)(PF_DETAIL_SITE_HANDLE(perfscope, &profiler::TimerRegistry::registerTimer, x), mask)
+
+// PF_PERF_SCOPE reads every counter, PF_PERF_SCOPE_COUNTERS the ones listed, any of PERF_CYCLES,
+// PERF_INSTRUCTIONS, PERF_LLC_MISSES and PERF_BRANCH_MISSES
+#if PF_ENABLED
+#define PF_PERF_SCOPE_CAT(cat, x) PF_DETAIL_PERF_SCOPE(cat, x, profiler::counters::PERF_ALL)
+#define PF_PERF_SCOPE_COUNTERS_CAT(cat, x, ...) PF_DETAIL_PERF_SCOPE(cat, x, PF_DETAIL_PERF_COUNTERS(__VA_ARGS__))
+#else
+#define PF_PERF_SCOPE_CAT(cat, x) static_cast<void>(0)
+#define PF_PERF_SCOPE_COUNTERS_CAT(cat, x, ...) static_cast<void>(0)
+#endif
+
+// declares var so awaiters can suspend and resume it, PF_ASYNC_SCOPE starts a new task
+#if PF_ENABLED
+#define PF_ASYNC_SCOPE_TASK(var, x, task) \
+    static constexpr bool CONCAT(var##stable_, __LINE__) = profiler::stableName<decltype((x))>; \
+    static const profiler::AsyncScopeIds CONCAT(var##ids_, __LINE__) = \
+        CONCAT(var##stable_, __LINE__) ? profiler::AsyncScope::registerIds(x) : profiler::AsyncScopeIds{}; \
+    profiler::AsyncScope var(CONCAT(var##stable_, __LINE__) ? CONCAT(var##ids_, __LINE__) : profiler::AsyncScope::registerIds(x), x, task)
+#define PF_ASYNC_SCOPE(var, x) PF_ASYNC_SCOPE_TASK(var, x, profiler::newTaskId())
+#else
+#define PF_ASYNC_SCOPE_TASK(var, x, task) profiler::NullAsyncScope var
+#define PF_ASYNC_SCOPE(var, x) profiler::NullAsyncScope var
+#endif
+
+// n and v are only evaluated when the category is enabled
+#if PF_ENABLED
+#define PF_DETAIL_INSTRUMENT(cat, var, registration, call, x, n) do { \
+        PF_DETAIL_SITE(cat, var, registration, x); \
+        if constexpr(CONCAT(var##enabled_, __LINE__)) { \
+            profiler::TimerId CONCAT(var##id_, __LINE__) = PF_DETAIL_SITE_HANDLE(var, registration, x).id; \
+            if(profiler::ProbeFilter::enabled(CONCAT(var##id_, __LINE__))) call(CONCAT(var##id_, __LINE__), (n)); \
+        } \
+    } while(0)
+#define PF_COUNTER_CAT(cat, x, n) PF_DETAIL_INSTRUMENT(cat, counter, &profiler::Instruments::registerCounter, profiler::Instruments::add, x, n)
+#define PF_GAUGE_CAT(cat, x, n) PF_DETAIL_INSTRUMENT(cat, gauge, &profiler::Instruments::registerGauge, profiler::Instruments::set, x, n)
+#define PF_THROUGHPUT_TIMER_CAT(cat, x, items) \
+    PF_DETAIL_SITE(cat, throughput, &profiler::Instruments::registerThroughput, x); \
+    profiler::CategoryProbe<CONCAT(throughputenabled_, __LINE__), profiler::ThroughputTimer> \
+        CONCAT(throughputtimer_, __LINE__)(PF_DETAIL_SITE_HANDLE(throughput, &profiler::Instruments::registerThroughput, x), (std::int64_t)(items))
+#else
+#define PF_COUNTER_CAT(cat, x, n) static_cast<void>(0)
+#define PF_GAUGE_CAT(cat, x, n) static_cast<void>(0)
+#define PF_THROUGHPUT_TIMER_CAT(cat, x, items) static_cast<void>(0)
+#endif
+
+// ends the frame named x on the calling thread and starts the next one
+#if PF_ENABLED
+#define PF_FRAME_MARK(x) do { \
+        PF_DETAIL_SITE(CAT_ALL, frame, &profiler::TimerRegistry::registerTimer, x); \
+        profiler::FrameTracker::mark(PF_DETAIL_SITE_HANDLE(frame, &profiler::TimerRegistry::registerTimer, x).id); \
+    } while(0)
+#else
+#define PF_FRAME_MARK(x) static_cast<void>(0)
+#endif
+
+#define PF_SCOPE_TIMER(x) PF_SCOPE_TIMER_CAT(CAT_DEFAULT, x)
+#define PF_AVERAGE_TIMER(x) PF_AVERAGE_TIMER_CAT(CAT_DEFAULT, x)
+#define PF_CUMULATIVE_TIMER(x) PF_CUMULATIVE_TIMER_CAT(CAT_DEFAULT, x)
+#define PF_HISTOGRAM_TIMER(x) PF_HISTOGRAM_TIMER_CAT(CAT_DEFAULT, x)
+#define PF_PERF_SCOPE(x) PF_PERF_SCOPE_CAT(CAT_DEFAULT, x)
+#define PF_PERF_SCOPE_COUNTERS(x, ...) PF_PERF_SCOPE_COUNTERS_CAT(CAT_DEFAULT, x, __VA_ARGS__)
+#define PF_COUNTER(x, n) PF_COUNTER_CAT(CAT_DEFAULT, x, n)
+#define PF_GAUGE(x, v) PF_GAUGE_CAT(CAT_DEFAULT, x, v)
+#define PF_THROUGHPUT_TIMER(x, items) PF_THROUGHPUT_TIMER_CAT(CAT_DEFAULT, x, items)
+
+// policy is profiler::everyNth(n) or profiler::oneIn(n), reported counts and totals are scaled by n
+#define PF_AVERAGE_TIMER_SAMPLED(x, policy) PF_AVERAGE_TIMER_SAMPLED_CAT(CAT_DEFAULT, x, policy)
+#define PF_CUMULATIVE_TIMER_SAMPLED(x, policy) PF_CUMULATIVE_TIMER_SAMPLED_CAT(CAT_DEFAULT, x, policy)
+#define PF_HISTOGRAM_TIMER_SAMPLED(x, policy) PF_HISTOGRAM_TIMER_SAMPLED_CAT(CAT_DEFAULT, x, policy)
+
+#define PF_ENABLE_THREAD_LOCAL_BUFFERS() profiler::AverageTimerManager::enableThreadLocalBuffers()
+#define PF_ENABLE_CPU_SHARDS() profiler::AverageTimerManager::enableCpuShards()
+#define PF_ENABLE_CPU_BREAKDOWN() (profiler::AverageTimerManager::enableCpuShards(), profiler::CpuShards::enableBreakdown())
+
+#define PF_ENABLE_TRACING() profiler::Tracer::enable()
+#define PF_DISABLE_TRACING() profiler::Tracer::enable(false)
+#define PF_WRITE_CHROME_TRACE(path) profiler::Tracer::writeChromeTrace(std::string(path))
+
+#define PF_ENABLE_ASYNC_OUTPUT(...) profiler::AsyncOutput::start(__VA_ARGS__)
+#define PF_DISABLE_ASYNC_OUTPUT() profiler::AsyncOutput::stop()
+
+#define PF_ENABLE_CALL_TREE() profiler::CallTree::enable()
+#define PF_DISABLE_CALL_TREE() profiler::CallTree::enable(false)
+#define PF_WRITE_CALL_TREE(stream) profiler::CallTree::writeReport(stream)
+#define PF_WRITE_FOLDED_STACKS(stream) profiler::CallTree::writeFolded(stream)
+
+// hz is per thread and per second of its cpu time, samples are symbolized by profiler-symbolize
+#ifdef PF_HAS_SAMPLER
+#define PF_START_SAMPLER(...) profiler::Sampler::start(__VA_ARGS__)
+#define PF_STOP_SAMPLER() profiler::Sampler::stop()
+#define PF_SAMPLE_THIS_THREAD() profiler::Sampler::registerThread()
+#define PF_WRITE_SAMPLES(path) profiler::Sampler::write(std::string(path))
+#else
+#define PF_START_SAMPLER(...) false
+#define PF_STOP_SAMPLER() static_cast<void>(0)
+#define PF_SAMPLE_THIS_THREAD() false
+#define PF_WRITE_SAMPLES(path) false
+#endif
+
+#define PF_OPEN_BINARY_LOG(path, capacity) profiler::BinaryLog::open(std::string(path), (capacity))
+#define PF_FLUSH_BINARY_LOG() profiler::BinaryLog::flush()
+#define PF_CLOSE_BINARY_LOG() profiler::BinaryLog::close()
+
+#define PF_START_METRICS_ENDPOINT(...) profiler::MetricsExporter::start(__VA_ARGS__)
+#define PF_STOP_METRICS_ENDPOINT() profiler::MetricsExporter::stop()
+#define PF_ENABLE_METRICS() profiler::MetricsExporter::enable()
+#define PF_WRITE_METRICS(stream) (profiler::MetricsExporter::refresh(), profiler::MetricsExporter::write(stream))
+
+// compare two summaries, or two binary logs, with profiler-diff
+#define PF_ENABLE_SUMMARY(...) profiler::Summary::enable(__VA_ARGS__)
+#define PF_WRITE_SUMMARY(path) profiler::Summary::write(std::string(path))
+
+// read the segment with profiler-top, it outlives the processes until PF_UNLINK_SHARED_MEMORY
+#define PF_START_SHARED_MEMORY(...) profiler::SharedMemoryExporter::start(__VA_ARGS__)
+#define PF_STOP_SHARED_MEMORY() profiler::SharedMemoryExporter::stop()
+#define PF_UNLINK_SHARED_MEMORY(...) profiler::SharedMemoryExporter::unlink(__VA_ARGS__)
+
+// switch probes at run time, a switched off probe costs one relaxed load
+#define PF_ENABLE_PROBES() profiler::RuntimeControl::enable()
+#define PF_DISABLE_PROBES() profiler::RuntimeControl::enable(false)
+#define PF_SET_PROBE_FILTER(list) profiler::RuntimeControl::setFilter(list)
+#define PF_WATCH_CONTROL_FILE(path) profiler::RuntimeControl::watch(std::string(path))
+#define PF_TOGGLE_PROBES_ON_SIGNAL(...) profiler::RuntimeControl::toggleOnSignal(__VA_ARGS__)
+
+// the costs are measured on first use, PF_CALIBRATE_PROBE_OVERHEAD() measures them again
+#define PF_CALIBRATE_PROBE_OVERHEAD() profiler::Calibration::run()
+#define PF_ENABLE_OVERHEAD_SUBTRACTION() profiler::Calibration::enableSubtraction()
+#define PF_DISABLE_OVERHEAD_SUBTRACTION() profiler::Calibration::enableSubtraction(false)
+#define PF_PROBE_OVERHEAD_LOG() profiler::Calibration::report()
+
+#define PF_STOP_AUTO_LOG() profiler::Reporter::stop()
+#define PF_FLUSH_AUTO_LOG() profiler::Reporter::flush()
+
+#define PF_AVERAGE_TIMER_LOG() profiler::AverageTimerManager::averageLog()
+#define PF_CUMULATIVE_TIMER_LOG() profiler::AverageTimerManager::cumulativeLog()
+#define PF_HISTOGRAM_TIMER_LOG() profiler::AverageTimerManager::histogramLog()
+#define PF_PERF_LOG() profiler::AverageTimerManager::perfLog()
+#define PF_FRAME_LOG() profiler::FrameTracker::log()
+#define PF_INSTRUMENT_LOG() profiler::Instruments::log()
+
+#define PF_SET_PROFILER_CLOCK(x) profiler::setProfilerClock<x>()
+#define PF_SET_AGGREGATION_MODE(x) profiler::profilerAggregationMode = (x)
+#define PF_SET_PROFILER_DURATION_UNIT(x) profiler::setProfilerDurationScale<x>()
+#define PF_SET_OUTPUT_STREAM(x) profiler::defaultProfilerOutputStream = (x)
+
+#define PF_SET_OUTPUT_FUNCTION(x) profiler::defaultProfilerOutputFunction = (x)
+#define PF_SET_CUMULATIVE_TIMER_OUTPUT_FUNCTION(x) profiler::defaultCumulativeTimerOutputFunction = (x)
+#define PF_SET_HISTOGRAM_OUTPUT_FUNCTION(x) profiler::defaultHistogramOutputFunction = (x)
+#define PF_SET_PERF_OUTPUT_FUNCTION(x) profiler::defaultPerfOutputFunction = (x)
+#define PF_SET_FRAME_OUTPUT_FUNCTION(x) profiler::defaultFrameOutputFunction = (x)
+#define PF_SET_INSTRUMENT_OUTPUT_FUNCTION(x) profiler::defaultInstrumentOutputFunction = (x)
+#define PF_SET_CPU_BREAKDOWN_OUTPUT_FUNCTION(x) profiler::defaultCpuBreakdownOutputFunction = (x)
+#define PF_SET_PROBE_OVERHEAD_OUTPUT_FUNCTION(x) profiler::defaultProbeOverheadOutputFunction = (x)
+#define PF_SET_ALLOCATION_OUTPUT_FUNCTION(x) profiler::defaultAllocationOutputFunction = (x)
+#define PF_SET_HISTOGRAM_PERCENTILES(...) profiler::defaultHistogramPercentiles = {__VA_ARGS__}
+#define PF_SET_AVERAGE_TIMER_PERCENTILES(...) profiler::defaultAverageTimerPercentiles = {__VA_ARGS__}
+#define PF_SET_AVERAGE_TIMER_PERCENTILES_OUTPUT_FUNCTION(x) profiler::defaultAverageTimerPercentilesOutputFunction = (x)
+#define PF_SET_AVERAGE_TIMER_STATS_OUTPUT_FUNCTION(x) profiler::defaultAverageTimerStatsOutputFunction = (x)
+#define PF_SET_AVERAGE_TIMER_INFO_OUTPUT_FUNCTION(x) profiler::defaultAverageTimerInfoOutputFunction = (x)
+
+#define PF_SET_AVERAGE_TIMER_SLEEP_DURATION(x) profiler::defaultAverageTimerSleepDuration = (x)
+#define PF_SET_CUMULATIVE_TIMER_SLEEP_DURATION(x) profiler::defaultCumulativeTimerSleepDuration = (x)
+#define PF_SET_HISTOGRAM_TIMER_SLEEP_DURATION(x) profiler::defaultHistogramTimerSleepDuration = (x)
+#define PF_SET_PERF_SLEEP_DURATION(x) profiler::defaultPerfTimerSleepDuration = (x)
+#define PF_SET_METRICS_SLEEP_DURATION(x) profiler::defaultMetricsSleepDuration = (x)
+#define PF_SET_FRAME_SLEEP_DURATION(x) profiler::defaultFrameSleepDuration = (x)
+#define PF_SET_INSTRUMENT_SLEEP_DURATION(x) profiler::defaultInstrumentSleepDuration = (x)
+#define PF_SET_SHARED_MEMORY_SLEEP_DURATION(x) profiler::defaultSharedMemorySleepDuration = (x)
+#define PF_SET_SUMMARY_SLEEP_DURATION(x) profiler::defaultSummarySleepDuration = (x)
+#define PF_SET_CONTROL_SLEEP_DURATION(x) profiler::defaultControlSleepDuration = (x)
+#define PF_SET_FRAME_BUDGET(x) profiler::defaultFrameBudget = (x)
+
+#define PF_SET_ARENA_CAPACITY(bytes) profiler::Arena::setCapacity(bytes)
 
 #define PF_SET_PROFILER_START_TIME() profiler::AverageTimerManager::setStartTime(profiler::profilerClock::now())
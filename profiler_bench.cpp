@@ -0,0 +1,204 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <ctime>
+#include <unistd.h>
+#include "profiler.hpp"
+
+// probe overhead of every timer type at 1, 2, 4 ... max threads, and memory growth per million samples
+// usage: profiler_bench [iterations per thread] [max threads]
+// the clock is whatever PF_CLOCK the target was built with, profiler_bench_tsc uses profiler::TscClock
+
+#define PF_BENCH_STRINGIFY2(x) #x
+#define PF_BENCH_STRINGIFY(x) PF_BENCH_STRINGIFY2(x)
+
+namespace {
+
+// formats everything like a real stream but throws the characters away
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+NullBuffer nullBuffer;
+std::ostream nullStream(&nullBuffer);
+
+struct Probe {
+    const char* name;
+    void (*body)();
+    void (*setup)();
+    void (*teardown)();
+};
+
+void noSetup() {}
+
+void resetCollected() {
+    profiler::AverageTimerManager::averageReport();
+    profiler::AverageTimerManager::cumulativeReport();
+    profiler::AverageTimerManager::histogramReport();
+    profiler::AverageTimerManager::enableThreadLocalBuffers(false);
+    profiler::AverageTimerManager::enableCpuShards(false);
+    profiler::profilerAggregationMode = profiler::AggregationMode::samples;
+}
+
+void emptyScope() {}
+void disabledScopeTimer() { PF_SCOPE_TIMER_CAT(0, "bench disabled scope"); }
+void scopeTimer() { PF_SCOPE_TIMER("bench scope"); }
+void averageTimer() { PF_AVERAGE_TIMER("bench average"); }
+void cumulativeTimer() { PF_CUMULATIVE_TIMER("bench cumulative"); }
+void histogramTimer() { PF_HISTOGRAM_TIMER("bench histogram"); }
+void sampledAverageTimer() { PF_AVERAGE_TIMER_SAMPLED("bench sampled average", profiler::everyNth(64)); }
+void counter() { PF_COUNTER("bench counter", 1); }
+void gauge() { PF_GAUGE("bench gauge", 1); }
+void throughputTimer() { PF_THROUGHPUT_TIMER("bench throughput", 1); }
+
+std::mutex plainMutex;
+profiler::ProfiledMutex profiledMutex("bench mutex");
+void plainLock() { std::lock_guard<std::mutex> lock(plainMutex); }
+void profiledLock() { std::lock_guard<profiler::ProfiledMutex> lock(profiledMutex); }
+
+void asyncSetup() { PF_ENABLE_ASYNC_OUTPUT(); }
+void asyncTeardown() { PF_DISABLE_ASYNC_OUTPUT(); }
+void callTreeSetup() { PF_ENABLE_CALL_TREE(); }
+void callTreeTeardown() { PF_DISABLE_CALL_TREE(); }
+void streamingSetup() { PF_SET_AGGREGATION_MODE(profiler::AggregationMode::streaming); }
+void threadLocalSetup() { PF_ENABLE_THREAD_LOCAL_BUFFERS(); }
+void cpuShardsSetup() { PF_ENABLE_CPU_SHARDS(); }
+void filteredSetup() { PF_SET_PROBE_FILTER("-bench average"); }
+void filteredTeardown() { PF_SET_PROBE_FILTER(""); }
+
+const Probe probes[] = {
+    {"empty call", emptyScope, noSetup, noSetup},
+    {"disabled category", disabledScopeTimer, noSetup, noSetup},
+    {"scope timer", scopeTimer, noSetup, noSetup},
+    {"scope timer, async", scopeTimer, asyncSetup, asyncTeardown},
+    {"scope timer, call tree", scopeTimer, callTreeSetup, callTreeTeardown},
+    {"average timer", averageTimer, noSetup, resetCollected},
+    {"average timer, streaming", averageTimer, streamingSetup, resetCollected},
+    {"average timer, thread local", averageTimer, threadLocalSetup, resetCollected},
+    {"average timer, cpu shards", averageTimer, cpuShardsSetup, resetCollected},
+    {"average timer, 1 in 64", sampledAverageTimer, noSetup, resetCollected},
+    {"average timer, filtered out", averageTimer, filteredSetup, filteredTeardown},
+    {"cumulative timer", cumulativeTimer, noSetup, resetCollected},
+    {"cumulative timer, thread local", cumulativeTimer, threadLocalSetup, resetCollected},
+    {"histogram timer", histogramTimer, noSetup, resetCollected},
+    {"histogram timer, thread local", histogramTimer, threadLocalSetup, resetCollected},
+    {"histogram timer, cpu shards", histogramTimer, cpuShardsSetup, resetCollected},
+    {"counter", counter, noSetup, noSetup},
+    {"gauge", gauge, noSetup, noSetup},
+    {"throughput timer", throughputTimer, noSetup, noSetup},
+    {"std::mutex lock", plainLock, noSetup, noSetup},
+    {"profiled mutex lock", profiledLock, noSetup, resetCollected},
+    {"profiled mutex lock, thread local", profiledLock, threadLocalSetup, resetCollected},
+};
+
+double threadCpuNs() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+struct Result {
+    double cpuNsPerOp; // mean cpu time per call over all threads
+    double mopsPerSecond; // calls completed by all threads per wall clock second
+};
+
+Result run(const Probe& probe, unsigned threads, std::size_t iterations) {
+    probe.setup();
+    std::atomic<unsigned> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<double> cpuNs(threads);
+    std::vector<std::thread> workers;
+    for(unsigned i = 0; i < threads; i++) {
+        workers.emplace_back([&, i] {
+            ready++;
+            while(!go.load(std::memory_order_acquire)) std::this_thread::yield();
+            double begin = threadCpuNs();
+            for(std::size_t n = 0; n < iterations; n++) probe.body();
+            cpuNs[i] = threadCpuNs() - begin;
+        });
+    }
+    while(ready.load() != threads) std::this_thread::yield();
+    auto begin = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for(auto& w : workers) w.join();
+    double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    probe.teardown();
+
+    double totalCpuNs = 0;
+    for(double ns : cpuNs) totalCpuNs += ns;
+    double calls = double(iterations) * threads;
+    return {totalCpuNs / calls, calls / wallSeconds / 1e6};
+}
+
+long residentBytes() {
+    std::ifstream statm("/proc/self/statm");
+    long pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+void memoryGrowth(const char* name, void (*body)(), void (*setup)()) {
+    constexpr std::size_t samples = 1000000;
+    setup();
+    long before = residentBytes();
+    std::size_t arenaBefore = profiler::Arena::used();
+    for(std::size_t n = 0; n < samples; n++) body();
+    long after = residentBytes();
+    std::size_t arenaAfter = profiler::Arena::used();
+    resetCollected();
+    // sample blocks freed by an earlier report are reused, so the arena can grow less than the samples need
+    std::cout << std::left << std::setw(34) << name << std::right
+              << std::setw(12) << (after - before) / 1024 << " KiB resident"
+              << std::setw(12) << (arenaAfter - arenaBefore) / 1024 << " KiB arena\n";
+}
+
+}
+
+int main(int argc, char** argv) {
+    std::size_t iterations = argc > 1 ? std::stoul(argv[1]) : 200000;
+    unsigned maxThreads = argc > 2 ? std::stoul(argv[2]) : std::max(1u, std::thread::hardware_concurrency());
+
+    PF_SET_OUTPUT_STREAM(&nullStream);
+
+    std::cout << "clock: " << PF_BENCH_STRINGIFY(PF_CLOCK) << "\n"
+              << "iterations per thread: " << iterations << ", max threads: " << maxThreads << "\n";
+#ifndef __OPTIMIZE__
+    std::cout << "warning: built without optimizations, configure with -DCMAKE_BUILD_TYPE=Release\n";
+#endif
+
+    // memory first, so no earlier run has left capacity behind for these sites
+    std::cout << "\nmemory growth per million samples\n";
+    memoryGrowth("average timer", averageTimer, noSetup);
+    memoryGrowth("average timer, streaming", averageTimer, streamingSetup);
+    memoryGrowth("cumulative timer", cumulativeTimer, noSetup);
+    memoryGrowth("histogram timer", histogramTimer, noSetup);
+
+    std::cout << "\n" << std::left << std::setw(34) << "probe" << std::right
+              << std::setw(8) << "threads" << std::setw(12) << "ns/op" << std::setw(12) << "net ns/op"
+              << std::setw(12) << "Mops/s" << "\n" << std::fixed << std::setprecision(2);
+    for(unsigned threads = 1;; threads = std::min(threads * 2, maxThreads)) {
+        double baseline = run(probes[0], threads, iterations).cpuNsPerOp;
+        for(auto& probe : probes) {
+            Result r = run(probe, threads, iterations);
+            std::cout << std::left << std::setw(34) << probe.name << std::right
+                      << std::setw(8) << threads << std::setw(12) << r.cpuNsPerOp
+                      << std::setw(12) << r.cpuNsPerOp - baseline << std::setw(12) << r.mopsPerSecond << "\n";
+        }
+        if(threads == maxThreads) break;
+    }
+
+    // what Calibration measured for PF_ENABLE_OVERHEAD_SUBTRACTION, single threaded
+    auto ns = [](profiler::ticks t) { return std::chrono::duration<double, std::nano>(profiler::profilerClock::toDuration(t)).count(); };
+    profiler::ProbeCosts c = PF_CALIBRATE_PROBE_OVERHEAD();
+    std::cout << "\ncalibrated overhead: clock " << ns(c.clock) << " ns per interval, average " << ns(c.average)
+              << " ns, cumulative " << ns(c.cumulative) << " ns, histogram " << ns(c.histogram)
+              << " ns, call tree scope " << ns(c.callTreeScope) << " ns per call\n";
+}
@@ -0,0 +1,79 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include "profiler.hpp"
+
+// offline decoder for logs written by PF_OPEN_BINARY_LOG
+// usage: profiler-decode <log file> [text|csv|trace]
+
+int main(int argc, char** argv) {
+    if(argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <log file> [text|csv|trace]\n";
+        return 2;
+    }
+    std::string format = argc > 2 ? argv[2] : "text";
+    if(format != "text" && format != "csv" && format != "trace") {
+        std::cerr << "unknown format " << format << ", expected text, csv or trace\n";
+        return 2;
+    }
+
+    std::ifstream file(argv[1], std::ios::binary);
+    if(!file) {
+        std::cerr << "could not open " << argv[1] << "\n";
+        return 1;
+    }
+    std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    profiler::BinaryLogContents log;
+    std::string error;
+    if(!profiler::readBinaryLog(data.data(), data.size(), log, error)) {
+        std::cerr << argv[1] << " " << error << "\n";
+        return 1;
+    }
+    profiler::BinaryLogHeader& header = log.header;
+    if(header.nsPerTick == 0.0) {
+        std::cerr << "warning: " << argv[1] << " was never flushed, assuming 1ns ticks\n";
+        header.nsPerTick = 1.0;
+    }
+    auto name = [&](profiler::TimerId id) {
+        return id < log.names.size() ? log.names[id] : "#" + std::to_string(id);
+    };
+    const std::vector<profiler::BinaryLogRecord>& records = log.records;
+
+    auto ns = [&](profiler::profilerClock::ticks t) { return (double)t * header.nsPerTick; };
+    std::cout << std::setprecision(15);
+
+    if(format == "csv") {
+        std::cout << "thread,id,start_ns,duration_ns\n";
+        for(auto& r : records) {
+            std::cout << r.thread << ",";
+            profiler::writeJsonString(std::cout, name(r.id));
+            std::cout << "," << ns(r.start) << "," << ns(r.duration) << "\n";
+        }
+    } else if(format == "trace") {
+        profiler::profilerClock::ticks origin = std::numeric_limits<profiler::profilerClock::ticks>::max();
+        for(auto& r : records) origin = std::min(origin, r.start);
+        std::cout << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        bool first = true;
+        for(auto& r : records) {
+            std::cout << (first ? "\n" : ",\n") << "{\"name\":";
+            profiler::writeJsonString(std::cout, name(r.id));
+            std::cout << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << r.thread
+                      << ",\"ts\":" << ns(r.start - origin) / 1000.0
+                      << ",\"dur\":" << ns(r.duration) / 1000.0 << "}";
+            first = false;
+        }
+        std::cout << "\n]}\n";
+    } else {
+        std::cout << std::setprecision(6);
+        for(auto& r : records) {
+            std::cout << "|| [thread " << r.thread << "] " << name(r.id) << " took "
+                      << ns(r.duration) / 1e9 << "s\n";
+        }
+    }
+
+    if(header.droppedRecords) std::cerr << header.droppedRecords << " records were dropped because the log was full\n";
+    return 0;
+}
@@ -0,0 +1,324 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include "profiler.hpp"
+
+// per-id changes between two runs, each a PF_WRITE_SUMMARY file or a PF_OPEN_BINARY_LOG log.
+// a mean is only called changed when welch's t statistic of the two runs exceeds --z, so noisy
+// timers need a larger shift. exits 1 when a significant mean or a p99 regressed past its threshold
+// usage: profiler-diff <baseline> <candidate> [--threshold pct] [--p99-threshold pct] [--z value] [--min-count n]
+
+namespace {
+
+struct Entry {
+    std::string kind;
+    std::uint64_t count = 0;
+    bool hasMoments = false;
+    double mean = 0.0;     // ns
+    double variance = 0.0; // ns squared
+    bool hasP99 = false;
+    double p99 = 0.0;      // ns
+};
+
+using Run = std::map<std::string, Entry>;
+
+// just enough json for the summary: objects, arrays, strings, numbers and literals
+class JsonReader {
+    const std::string& text;
+    std::size_t pos = 0;
+
+    void skipSpace() {
+        while(pos < text.size() && std::isspace((unsigned char)text[pos])) pos++;
+    }
+
+    bool consume(char c) {
+        skipSpace();
+        if(pos < text.size() && text[pos] == c) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+public:
+    struct Value {
+        enum Type { nullValue, numberValue, stringValue, objectValue, arrayValue } type = nullValue;
+        double number = 0.0;
+        std::string string;
+        std::vector<std::pair<std::string, Value>> members;
+        std::vector<Value> elements;
+
+        const Value* find(const std::string& key) const {
+            for(auto& [k, v] : members) if(k == key) return &v;
+            return nullptr;
+        }
+    };
+
+    explicit JsonReader(const std::string& _text) : text(_text) {}
+
+    bool parseString(std::string& out) {
+        if(!consume('"')) return false;
+        while(pos < text.size() && text[pos] != '"') {
+            char c = text[pos++];
+            if(c != '\\') {
+                out += c;
+                continue;
+            }
+            if(pos >= text.size()) return false;
+            char e = text[pos++];
+            switch(e) {
+            case 'n': out += '\n'; break;
+            case 't': out += '\t'; break;
+            case 'r': out += '\r'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'u': {
+                if(pos + 4 > text.size()) return false;
+                unsigned code = (unsigned)std::stoul(text.substr(pos, 4), nullptr, 16);
+                pos += 4;
+                // the summary only escapes control characters this way
+                if(code < 0x80) out += (char)code;
+                else out += '?';
+                break;
+            }
+            default: out += e;
+            }
+        }
+        return consume('"');
+    }
+
+    bool parse(Value& v) {
+        skipSpace();
+        if(pos >= text.size()) return false;
+        char c = text[pos];
+        if(c == '{') {
+            pos++;
+            v.type = Value::objectValue;
+            if(consume('}')) return true;
+            do {
+                std::string key;
+                Value member;
+                if(!parseString(key) || !consume(':') || !parse(member)) return false;
+                v.members.emplace_back(std::move(key), std::move(member));
+            } while(consume(','));
+            return consume('}');
+        }
+        if(c == '[') {
+            pos++;
+            v.type = Value::arrayValue;
+            if(consume(']')) return true;
+            do {
+                v.elements.emplace_back();
+                if(!parse(v.elements.back())) return false;
+            } while(consume(','));
+            return consume(']');
+        }
+        if(c == '"') {
+            v.type = Value::stringValue;
+            return parseString(v.string);
+        }
+        for(const char* literal : {"true", "false", "null"}) {
+            if(text.compare(pos, std::strlen(literal), literal) == 0) {
+                pos += std::strlen(literal);
+                return true;
+            }
+        }
+        const char* begin = text.c_str() + pos;
+        char* end = nullptr;
+        v.type = Value::numberValue;
+        v.number = std::strtod(begin, &end);
+        if(end == begin) return false;
+        pos += (std::size_t)(end - begin);
+        return true;
+    }
+};
+
+bool loadSummary(const std::string& path, const std::string& text, Run& run) {
+    JsonReader reader(text);
+    JsonReader::Value root;
+    const JsonReader::Value* format;
+    const JsonReader::Value* timers;
+    if(!reader.parse(root) || !(format = root.find("format")) || format->string != "profiler summary"
+        || !(timers = root.find("timers")) || timers->type != JsonReader::Value::arrayValue) {
+        std::cerr << path << " is not a summary\n";
+        return false;
+    }
+    for(auto& t : timers->elements) {
+        const JsonReader::Value* name = t.find("name");
+        const JsonReader::Value* kind = t.find("kind");
+        if(!name || !kind) continue;
+        Entry& e = run[name->string];
+        // an id can be several kinds at once, the diff follows the first one
+        if(!e.kind.empty()) continue;
+        e.kind = kind->string;
+        if(auto v = t.find("count")) e.count = (std::uint64_t)v->number;
+        const JsonReader::Value* mean = t.find("mean_ns");
+        const JsonReader::Value* variance = t.find("variance_ns2");
+        if(mean && variance) {
+            e.hasMoments = true;
+            e.mean = mean->number;
+            e.variance = variance->number;
+        }
+        if(auto v = t.find("p99_ns")) {
+            e.hasP99 = true;
+            e.p99 = v->number;
+        }
+    }
+    return true;
+}
+
+// every record of a binary log is one call, so the moments and the p99 are exact
+bool loadBinaryLog(const std::string& path, const std::string& data, Run& run) {
+    profiler::BinaryLogContents log;
+    std::string error;
+    if(!profiler::readBinaryLog(data.data(), data.size(), log, error)) {
+        std::cerr << path << " " << error << "\n";
+        return false;
+    }
+    const profiler::BinaryLogHeader& header = log.header;
+    double nsPerTick = header.nsPerTick != 0.0 ? header.nsPerTick : 1.0;
+    const std::vector<std::string>& names = log.names;
+    std::map<profiler::TimerId, std::vector<double>> durations;
+    for(auto& r : log.records) durations[r.id].push_back((double)r.duration * nsPerTick);
+    for(auto& [id, values] : durations) {
+        Entry& e = run[id < names.size() ? names[id] : "#" + std::to_string(id)];
+        e.kind = "log";
+        e.count = values.size();
+        e.hasMoments = true;
+        double m2 = 0.0;
+        std::uint64_t n = 0;
+        for(double v : values) {
+            double delta = v - e.mean;
+            e.mean += delta / (double)++n;
+            m2 += delta * (v - e.mean);
+        }
+        e.variance = e.count > 1 ? m2 / (double)(e.count - 1) : 0.0;
+        // nearest rank, like Histogram::percentile
+        std::size_t rank = (std::size_t)std::ceil(0.99 * (double)values.size());
+        std::nth_element(values.begin(), values.begin() + (rank - 1), values.end());
+        e.hasP99 = true;
+        e.p99 = values[rank - 1];
+    }
+    if(header.droppedRecords) std::cerr << "warning: " << path << " dropped " << header.droppedRecords << " records\n";
+    return true;
+}
+
+bool load(const std::string& path, Run& run) {
+    std::ifstream file(path, std::ios::binary);
+    if(!file) {
+        std::cerr << "could not open " << path << "\n";
+        return false;
+    }
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if(data.size() >= sizeof(profiler::BinaryLogHeader) && std::memcmp(data.data(), profiler::binaryLogMagic, sizeof(profiler::BinaryLogHeader::magic)) == 0) {
+        return loadBinaryLog(path, data, run);
+    }
+    return loadSummary(path, data, run);
+}
+
+double percentChange(double before, double after) {
+    return before != 0.0 ? (after - before) / before * 100.0 : 0.0;
+}
+
+std::string formatNs(double ns) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(ns < 1e3 ? 1 : 3);
+    if(ns < 1e3) out << ns << "ns";
+    else if(ns < 1e6) out << ns / 1e3 << "us";
+    else if(ns < 1e9) out << ns / 1e6 << "ms";
+    else out << ns / 1e9 << "s";
+    return out.str();
+}
+
+std::string formatChange(double pct) {
+    std::ostringstream out;
+    out << std::showpos << std::fixed << std::setprecision(1) << pct << "%";
+    return out.str();
+}
+
+}
+
+int main(int argc, char** argv) {
+    double threshold = 5.0;
+    double p99Threshold = 0.0; // off
+    double z = 3.0;
+    std::uint64_t minCount = 30;
+    std::vector<std::string> paths;
+    bool usage = false;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if(arg == "--threshold" && hasValue) threshold = std::stod(argv[++i]);
+        else if(arg == "--p99-threshold" && hasValue) p99Threshold = std::stod(argv[++i]);
+        else if(arg == "--z" && hasValue) z = std::stod(argv[++i]);
+        else if(arg == "--min-count" && hasValue) minCount = std::stoull(argv[++i]);
+        else if(arg.rfind("--", 0) == 0) usage = true;
+        else paths.push_back(arg);
+    }
+    if(usage || paths.size() != 2) {
+        std::cerr << "usage: " << argv[0] << " <baseline> <candidate> [--threshold pct] [--p99-threshold pct] [--z value] [--min-count n]\n";
+        return 2;
+    }
+
+    Run baseline, candidate;
+    if(!load(paths[0], baseline) || !load(paths[1], candidate)) return 2;
+
+    std::map<std::string, bool> names;
+    for(auto& [name, e] : baseline) names[name] = true;
+    for(auto& [name, e] : candidate) names[name] = true;
+
+    std::size_t regressions = 0;
+    std::cout << std::left << std::setw(32) << "name" << std::right << std::setw(12) << "calls" << std::setw(10) << "change"
+              << std::setw(14) << "mean" << std::setw(10) << "change" << std::setw(8) << "t"
+              << std::setw(14) << "p99" << std::setw(10) << "change" << "  verdict\n";
+    for(auto& [name, unused] : names) {
+        auto a = baseline.find(name);
+        auto b = candidate.find(name);
+        std::cout << std::left << std::setw(32) << name.substr(0, 31) << std::right;
+        if(a == baseline.end() || b == candidate.end()) {
+            const Entry& e = a == baseline.end() ? b->second : a->second;
+            std::cout << std::setw(12) << e.count << std::setw(10) << "" << std::setw(14) << (e.hasMoments ? formatNs(e.mean) : "-")
+                      << std::setw(10) << "" << std::setw(8) << "" << std::setw(14) << (e.hasP99 ? formatNs(e.p99) : "-")
+                      << std::setw(10) << "" << (a == baseline.end() ? "  new\n" : "  gone\n");
+            continue;
+        }
+        const Entry& x = a->second;
+        const Entry& y = b->second;
+        std::cout << std::setw(12) << y.count << std::setw(10) << formatChange(percentChange((double)x.count, (double)y.count));
+
+        std::string verdict;
+        bool enough = x.count >= minCount && y.count >= minCount;
+        if(x.hasMoments && y.hasMoments) {
+            double meanChange = percentChange(x.mean, y.mean);
+            // welch's t on the difference of the means
+            double se = std::sqrt(x.variance / (double)x.count + y.variance / (double)y.count);
+            double t = se > 0.0 ? (y.mean - x.mean) / se : (y.mean == x.mean ? 0.0 : std::copysign(INFINITY, y.mean - x.mean));
+            bool significant = enough && std::fabs(t) >= z;
+            std::cout << std::setw(14) << formatNs(y.mean) << std::setw(10) << formatChange(meanChange)
+                      << std::setw(8) << std::fixed << std::setprecision(1) << std::showpos << t << std::noshowpos;
+            if(significant && meanChange > threshold) verdict = "mean regressed";
+            else if(significant && meanChange < -threshold) verdict = "mean improved";
+        }
+        else std::cout << std::setw(14) << "-" << std::setw(10) << "" << std::setw(8) << "";
+        if(x.hasP99 && y.hasP99) {
+            double p99Change = percentChange(x.p99, y.p99);
+            std::cout << std::setw(14) << formatNs(y.p99) << std::setw(10) << formatChange(p99Change);
+            if(p99Threshold > 0.0 && enough && p99Change > p99Threshold) verdict += verdict.empty() ? "p99 regressed" : ", p99 regressed";
+        }
+        else std::cout << std::setw(14) << "-" << std::setw(10) << "";
+        if(verdict.find("regressed") != std::string::npos) regressions++;
+        if(verdict.empty()) verdict = enough ? "no significant change" : "too few calls";
+        std::cout << "  " << verdict << "\n";
+    }
+    if(regressions) {
+        std::cerr << regressions << " timers regressed past the threshold\n";
+        return 1;
+    }
+    return 0;
+}
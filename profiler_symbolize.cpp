@@ -0,0 +1,178 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+
+// turns a PF_WRITE_SAMPLES file into folded stacks, one "scope;outer;...;inner count" line per
+// distinct stack, rooted at the innermost PF_SCOPE_TIMER that was running. pipe the output into
+// flamegraph.pl or load it into speedscope. symbols come from addr2line, so it has to be on PATH
+// usage: profiler-symbolize <samples file> [--threads]
+
+namespace {
+
+struct Mapping {
+    std::uintptr_t start;
+    std::uintptr_t end;
+    std::uintptr_t offset;
+    std::string path;
+};
+
+struct Sample {
+    std::string thread;
+    std::string scope;
+    std::vector<std::uintptr_t> frames; // innermost first
+};
+
+std::string hex(std::uintptr_t value) {
+    char buffer[2 + 2 * sizeof(value) + 1];
+    std::snprintf(buffer, sizeof(buffer), "0x%jx", (std::uintmax_t)value);
+    return buffer;
+}
+
+std::string quote(const std::string& s) {
+    std::string out = "'";
+    for(char c : s) {
+        if(c == '\'') out += "'\\''";
+        else out += c;
+    }
+    return out + "'";
+}
+
+// executables linked without -pie are loaded at their link address, everything else relative to its mapping
+bool positionDependent(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    unsigned char header[18] = {};
+    file.read(reinterpret_cast<char*>(header), sizeof(header));
+    if(!file || header[0] != 0x7f || header[1] != 'E' || header[2] != 'L' || header[3] != 'F') return false;
+    unsigned type = header[5] == 2 ? (header[16] << 8 | header[17]) : (header[17] << 8 | header[16]);
+    return type == 2; // ET_EXEC
+}
+
+// asks addr2line for every address of one module, a few hundred per invocation
+void resolve(const std::string& path, const std::vector<std::uintptr_t>& addresses, std::vector<std::string>& names) {
+    constexpr std::size_t batch = 256;
+    for(std::size_t first = 0; first < addresses.size(); first += batch) {
+        std::ostringstream command;
+        command << "addr2line -f -C -e " << quote(path) << std::hex;
+        std::size_t last = std::min(addresses.size(), first + batch);
+        for(std::size_t i = first; i < last; i++) command << " 0x" << addresses[i];
+        command << " 2>/dev/null";
+        FILE* pipe = popen(command.str().c_str(), "r");
+        std::string output;
+        if(pipe) {
+            char buffer[4096];
+            for(std::size_t n; (n = fread(buffer, 1, sizeof(buffer), pipe)) > 0;) output.append(buffer, n);
+            pclose(pipe);
+        }
+        // two lines per address, the function and its file:line
+        std::istringstream lines(output);
+        std::string function, location;
+        for(std::size_t i = first; i < last && std::getline(lines, function) && std::getline(lines, location); i++) {
+            if(function != "??") names[i] = function;
+        }
+    }
+}
+
+}
+
+int main(int argc, char** argv) {
+    std::string input;
+    bool byThread = false;
+    for(int i = 1; i < argc; i++) {
+        if(std::string(argv[i]) == "--threads") byThread = true;
+        else if(input.empty()) input = argv[i];
+        else input.clear(), i = argc;
+    }
+    if(input.empty()) {
+        std::cerr << "usage: " << argv[0] << " <samples file> [--threads]\n";
+        return 2;
+    }
+    std::ifstream in(input);
+    std::string line;
+    if(!in || !std::getline(in, line) || line.rfind("# profiler samples ", 0) != 0) {
+        std::cerr << "not a sample file: " << input << "\n";
+        return 1;
+    }
+
+    std::vector<Mapping> mappings;
+    std::map<std::string, std::string> scopes;
+    std::vector<Sample> samples;
+    std::uint64_t dropped = 0;
+    while(std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string tag;
+        fields >> tag;
+        if(tag == "map") {
+            Mapping m;
+            fields >> std::hex >> m.start >> m.end >> m.offset;
+            std::getline(fields >> std::ws, m.path);
+            mappings.push_back(m);
+        } else if(tag == "scope") {
+            std::string id, name;
+            fields >> id;
+            std::getline(fields >> std::ws, name);
+            scopes[id] = name;
+        } else if(tag == "sample") {
+            Sample s;
+            std::string time;
+            fields >> s.thread >> time >> s.scope >> std::hex;
+            for(std::uintptr_t address; fields >> address;) s.frames.push_back(address);
+            samples.push_back(std::move(s));
+        } else if(tag == "dropped") {
+            fields >> dropped;
+        }
+    }
+    std::sort(mappings.begin(), mappings.end(), [](const Mapping& a, const Mapping& b) { return a.start < b.start; });
+
+    // every distinct address once per module. return addresses point after the call, so the
+    // caller frames are looked up one byte earlier to land on the call instruction
+    std::map<std::uintptr_t, std::string> symbols;
+    std::map<std::size_t, std::vector<std::uintptr_t>> perModule;
+    for(auto& s : samples) {
+        for(std::size_t i = 0; i < s.frames.size(); i++) {
+            std::uintptr_t address = i ? s.frames[i] - 1 : s.frames[i];
+            if(symbols.emplace(address, std::string()).second) {
+                auto it = std::upper_bound(mappings.begin(), mappings.end(), address,
+                                           [](std::uintptr_t a, const Mapping& m) { return a < m.start; });
+                if(it != mappings.begin() && address < (it - 1)->end) perModule[it - 1 - mappings.begin()].push_back(address);
+            }
+        }
+    }
+    for(auto& [index, addresses] : perModule) {
+        const Mapping& m = mappings[index];
+        bool absolute = positionDependent(m.path);
+        std::vector<std::uintptr_t> relative;
+        for(std::uintptr_t a : addresses) relative.push_back(absolute ? a : a - m.start + m.offset);
+        std::vector<std::string> names(addresses.size());
+        resolve(m.path, relative, names);
+        std::string module = m.path.substr(m.path.rfind('/') + 1);
+        for(std::size_t i = 0; i < addresses.size(); i++) {
+            if(!names[i].empty()) symbols[addresses[i]] = names[i];
+            else symbols[addresses[i]] = module + "+" + hex(relative[i]);
+        }
+    }
+
+    std::map<std::string, std::uint64_t> folded;
+    for(auto& s : samples) {
+        std::string stack;
+        if(byThread) stack = "thread " + s.thread + ";";
+        auto scope = scopes.find(s.scope);
+        stack += scope != scopes.end() ? scope->second : "[no scope]";
+        for(std::size_t i = s.frames.size(); i-- > 0;) {
+            std::uintptr_t address = i ? s.frames[i] - 1 : s.frames[i];
+            std::string name = symbols[address];
+            if(name.empty()) name = hex(address);
+            // ; separates frames in the folded format
+            std::replace(name.begin(), name.end(), ';', ':');
+            stack += ";" + name;
+        }
+        folded[stack]++;
+    }
+    for(auto& [stack, count] : folded) std::cout << stack << " " << count << "\n";
+    if(dropped) std::cerr << dropped << " samples were dropped, the reporter thread drained the queue too slowly\n";
+}
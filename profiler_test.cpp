@@ -0,0 +1,229 @@
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstring>
+#include "profiler.hpp"
+
+// invariants of the aggregation code that demo output would not show going wrong, run by ctest
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond) do { \
+        if(!(cond)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond "\n"; \
+            failures++; \
+        } \
+    } while(0)
+
+bool near(double a, double b, double relative) {
+    return std::abs(a - b) <= relative * std::max(1.0, std::max(std::abs(a), std::abs(b)));
+}
+
+std::vector<profiler::ticks> randomSamples(std::size_t n, std::uint32_t seed) {
+    std::mt19937_64 rng(seed);
+    std::lognormal_distribution<double> dist(8.0, 1.5);
+    std::vector<profiler::ticks> v(n);
+    for(auto& t : v) t = (profiler::ticks)dist(rng);
+    return v;
+}
+
+// welford per sample, the blocked addSamples and the chan merge of uneven parts all agree with
+// the two pass mean and variance
+void runningStatsMatchTwoPass() {
+    std::vector<profiler::ticks> v = randomSamples(100003, 1);
+    double mean = 0.0;
+    for(auto t : v) mean += (double)t;
+    mean /= (double)v.size();
+    double m2 = 0.0;
+    for(auto t : v) m2 += ((double)t - mean) * ((double)t - mean);
+    double variance = m2 / (double)(v.size() - 1);
+
+    profiler::RunningStats single;
+    for(auto t : v) single.add(t);
+    profiler::RunningStats blocked;
+    blocked.addSamples(v.data(), v.size());
+    profiler::RunningStats merged;
+    for(std::size_t begin = 0, size = 1; begin < v.size(); begin += size, size = size * 3 + 1) {
+        profiler::RunningStats part;
+        part.addSamples(v.data() + begin, std::min(size, v.size() - begin));
+        merged.merge(part);
+    }
+    profiler::RunningStats weighted;
+    for(std::size_t i = 0; i + 1 < v.size(); i += 2) {
+        weighted.add(v[i]);
+        weighted.add(v[i + 1]);
+    }
+    weighted.add(v.back());
+
+    for(const profiler::RunningStats* s : {&single, &blocked, &merged, &weighted}) {
+        CHECK(s->count == v.size());
+        CHECK(near(s->mean, mean, 1e-9));
+        CHECK(near(s->variance(), variance, 1e-9));
+        CHECK(s->min == *std::min_element(v.begin(), v.end()));
+        CHECK(s->max == *std::max_element(v.begin(), v.end()));
+    }
+
+    // a weight stands for that many equal samples
+    profiler::RunningStats repeated;
+    profiler::RunningStats heavy;
+    for(int i = 0; i < 5; i++) repeated.add(100);
+    for(int i = 0; i < 3; i++) repeated.add(7);
+    heavy.add(100, 5);
+    heavy.add(7, 3);
+    CHECK(repeated.count == heavy.count);
+    CHECK(near(repeated.mean, heavy.mean, 1e-12));
+    CHECK(near(repeated.variance(), heavy.variance(), 1e-12));
+}
+
+// every histogram percentile is within 1/subBucketCount of the exact nearest rank value
+void histogramPercentilesWithinBound() {
+    std::vector<profiler::ticks> v = randomSamples(50000, 2);
+    profiler::Histogram h;
+    for(auto t : v) h.record(t);
+    std::vector<profiler::ticks> sorted = v;
+    std::sort(sorted.begin(), sorted.end());
+    for(double p : {0.0, 1.0, 10.0, 50.0, 90.0, 99.0, 99.9, 99.99, 100.0}) {
+        std::size_t rank = std::clamp<std::size_t>((std::size_t)std::ceil(p / 100.0 * (double)sorted.size()), 1, sorted.size());
+        double exact = (double)sorted[rank - 1];
+        double reported = (double)profiler::profilerClock::toTicks(h.percentile(p));
+        CHECK(std::abs(reported - exact) <= exact / (double)profiler::Histogram::subBucketCount + 1.0);
+    }
+    CHECK(h.count() == v.size());
+    profiler::ticks sum = 0;
+    for(auto t : v) sum += t;
+    CHECK(h.sum() == sum);
+
+    // small values are exact
+    profiler::Histogram small;
+    for(profiler::ticks t = 0; t < (profiler::ticks)profiler::Histogram::subBucketCount; t++) small.record(t);
+    CHECK(profiler::profilerClock::toTicks(small.percentile(50.0)) == (profiler::ticks)profiler::Histogram::subBucketCount / 2 - 1);
+}
+
+// the vector kernels give the scalar sum, min and max for every length and tail
+void reductionsMatchScalar() {
+    std::vector<profiler::ticks> v = randomSamples(300, 3);
+    v[7] = std::numeric_limits<profiler::ticks>::max() / 4;
+    v[11] = -5;
+    for(std::size_t n = 0; n <= v.size(); n++) {
+        profiler::SampleMoments scalar = profiler::reduceSamplesScalar(v.data(), n);
+        auto same = [&](const profiler::SampleMoments& m) {
+            return m.sum == scalar.sum && m.min == scalar.min && m.max == scalar.max;
+        };
+        CHECK(same(profiler::reduceSamples(v.data(), n)));
+#ifdef PF_HAS_AVX_REDUCTION
+        if(__builtin_cpu_supports("avx2")) CHECK(same(profiler::reduceSamplesAvx2(v.data(), n)));
+        if(__builtin_cpu_supports("avx512f")) CHECK(same(profiler::reduceSamplesAvx512(v.data(), n)));
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+        CHECK(same(profiler::reduceSamplesNeon(v.data(), n)));
+#endif
+    }
+}
+
+#ifdef PF_HAS_BINARY_LOG
+std::string binaryLog(const std::vector<std::string>& names, const std::vector<profiler::BinaryLogRecord>& records) {
+    std::string table;
+    for(auto& name : names) {
+        std::uint32_t length = (std::uint32_t)name.size();
+        table.append(reinterpret_cast<const char*>(&length), sizeof(length)).append(name);
+    }
+    profiler::BinaryLogHeader header{};
+    std::memcpy(header.magic, profiler::binaryLogMagic, sizeof(header.magic));
+    header.version = profiler::binaryLogVersion;
+    header.recordSize = sizeof(profiler::BinaryLogRecord);
+    header.recordCapacity = header.recordCount = records.size();
+    header.stringTableOffset = sizeof(header);
+    header.stringTableCapacity = header.stringTableSize = table.size();
+    header.stringCount = names.size();
+    header.recordsOffset = sizeof(header) + table.size();
+    header.nsPerTick = 1.0;
+    std::string data(reinterpret_cast<const char*>(&header), sizeof(header));
+    data += table;
+    data.append(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(profiler::BinaryLogRecord));
+    return data;
+}
+
+// a whole log reads back, every shorter prefix and a name running past the table are refused
+void binaryLogReaderIsBounded() {
+    std::vector<profiler::BinaryLogRecord> records = {{0, 0, 10, 5}, {}, {1, 2, 20, 7}};
+    std::string data = binaryLog({"parse", "render"}, records);
+    profiler::BinaryLogContents log;
+    std::string error;
+    CHECK(profiler::readBinaryLog(data.data(), data.size(), log, error));
+    CHECK(log.names.size() == 2 && log.names[0] == "parse" && log.names[1] == "render");
+    CHECK(log.records.size() == 2); // the zeroed record was never written
+    for(std::size_t size = 0; size < data.size(); size++) {
+        std::vector<char> prefix(data.begin(), data.begin() + size);
+        CHECK(!profiler::readBinaryLog(prefix.data(), prefix.size(), log, error));
+    }
+
+    std::string corrupt = data;
+    std::uint32_t length = 0xfffffff0u;
+    std::memcpy(&corrupt[sizeof(profiler::BinaryLogHeader)], &length, sizeof(length));
+    CHECK(!profiler::readBinaryLog(corrupt.data(), corrupt.size(), log, error));
+
+    std::string overflowing = data;
+    profiler::BinaryLogHeader header;
+    std::memcpy(&header, overflowing.data(), sizeof(header));
+    header.recordCount = std::numeric_limits<std::uint64_t>::max() / 2;
+    std::memcpy(&overflowing[0], &header, sizeof(header));
+    CHECK(!profiler::readBinaryLog(overflowing.data(), overflowing.size(), log, error));
+}
+#endif
+
+// writers keep adding while reports swap the collected and retired buffers, every sample ends
+// up in exactly one report
+void reportsLoseNoSamples(const char* name) {
+    constexpr int threads = 4;
+    constexpr int samplesPerThread = 20000;
+    profiler::TimerId id = profiler::TimerRegistry::registerTimer(name);
+    std::uint64_t reportedCount = 0;
+    profiler::ticks reportedSum = 0;
+    PF_SET_AVERAGE_TIMER_INFO_OUTPUT_FUNCTION([](profiler::profilerClock::duration) {});
+    PF_SET_AVERAGE_TIMER_STATS_OUTPUT_FUNCTION([&](std::string_view n, const profiler::RunningStats& s) {
+        if(n != name) return;
+        reportedCount += s.count;
+        reportedSum += s.sum;
+    });
+    std::atomic<bool> done{false};
+    std::vector<std::thread> writers;
+    for(int t = 0; t < threads; t++) {
+        writers.emplace_back([&, t] {
+            for(int i = 0; i < samplesPerThread; i++) profiler::AverageTimerManager::addAverageTime(id, t + 1);
+        });
+    }
+    std::thread reporter([&] {
+        while(!done.load()) profiler::AverageTimerManager::averageReport();
+    });
+    for(auto& w : writers) w.join();
+    done = true;
+    reporter.join();
+    profiler::AverageTimerManager::averageReport();
+    PF_SET_AVERAGE_TIMER_STATS_OUTPUT_FUNCTION(nullptr);
+    CHECK(reportedCount == (std::uint64_t)threads * samplesPerThread);
+    CHECK(reportedSum == (profiler::ticks)samplesPerThread * (threads * (threads + 1) / 2));
+}
+
+}
+
+int main() {
+    runningStatsMatchTwoPass();
+    histogramPercentilesWithinBound();
+    reductionsMatchScalar();
+#ifdef PF_HAS_BINARY_LOG
+    binaryLogReaderIsBounded();
+#endif
+    reportsLoseNoSamples("locked");
+    profiler::AverageTimerManager::enableThreadLocalBuffers();
+    reportsLoseNoSamples("thread local buffers");
+    profiler::AverageTimerManager::enableCpuShards();
+    reportsLoseNoSamples("cpu shards");
+    profiler::AverageTimerManager::enableThreadLocalBuffers(false);
+    profiler::AverageTimerManager::enableCpuShards(false);
+    if(failures) std::cerr << failures << " checks failed\n";
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,164 @@
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include "profiler.hpp"
+
+// live view of every process publishing with PF_START_SHARED_MEMORY
+// usage: profiler-top [segment name] [refresh ms] [--once]
+
+#ifdef PF_HAS_SHARED_MEMORY
+namespace {
+
+struct Row {
+    std::uint32_t processes = 0;
+    std::uint64_t count = 0;
+    std::int64_t ns = 0;
+    std::int64_t value = 0;
+};
+
+struct Process {
+    std::int32_t pid;
+    std::string name;
+    double age; // seconds since the process last published, negative before its first publish
+};
+
+struct Stat {
+    std::uint64_t count;
+    std::int64_t ns;
+    std::int64_t value;
+};
+
+using Key = std::pair<std::uint32_t, std::string>;
+
+// reads every live process's row, retrying a row the process is writing
+void read(const profiler::SharedSegment& segment, std::map<Key, Row>& rows, std::vector<Process>& processes) {
+    const profiler::SharedSegmentHeader& h = segment.header();
+    std::uint32_t slots = std::min(h.slotsClaimed.load(std::memory_order_acquire), h.maxSlots);
+    std::vector<Key> keys(slots);
+    for(std::uint32_t i = 0; i < slots; i++) {
+        const profiler::SharedSlot& slot = segment.slot(i);
+        if(slot.state.load(std::memory_order_acquire) != profiler::sharedSlotNamed) continue;
+        keys[i] = {slot.kind, std::string(slot.name, strnlen(slot.name, profiler::sharedNameSize))};
+    }
+    std::int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    for(std::uint32_t p = 0; p < h.maxProcesses; p++) {
+        const profiler::SharedProcess& entry = segment.process(p);
+        std::int32_t pid = entry.pid.load(std::memory_order_acquire);
+        if(!profiler::SharedSegment::alive(pid)) continue;
+        std::vector<Stat> snapshot(slots);
+        std::int64_t publishedAt = 0;
+        for(int attempt = 0; attempt < 100; attempt++) {
+            std::uint32_t before = entry.sequence.load(std::memory_order_acquire);
+            if(before & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            for(std::uint32_t i = 0; i < slots; i++) {
+                const profiler::SharedStat& st = segment.stat(p, i);
+                snapshot[i] = {st.count.load(std::memory_order_relaxed), st.ns.load(std::memory_order_relaxed),
+                               st.value.load(std::memory_order_relaxed)};
+            }
+            publishedAt = entry.publishedAt.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(entry.sequence.load(std::memory_order_relaxed) == before) break;
+        }
+        processes.push_back({pid, std::string(entry.name, strnlen(entry.name, sizeof(entry.name))),
+                             publishedAt ? (now - publishedAt) / 1e9 : -1.0});
+        std::map<Key, bool> seen;
+        for(std::uint32_t i = 0; i < slots; i++) {
+            std::uint64_t count = snapshot[i].count;
+            if(count == 0 || keys[i].second.empty()) continue;
+            Row& row = rows[keys[i]];
+            if(!seen[keys[i]]) row.processes++;
+            seen[keys[i]] = true;
+            row.count += count;
+            row.ns += snapshot[i].ns;
+            row.value += snapshot[i].value;
+        }
+    }
+}
+
+const char* kindName(std::uint32_t kind) {
+    return kind < std::size(profiler::statKindNames) ? profiler::statKindNames[kind] : "?";
+}
+
+void print(const std::map<Key, Row>& rows, const std::map<Key, Row>& previous, const std::vector<Process>& processes, double interval) {
+    std::cout << processes.size() << " processes\n";
+    for(auto& p : processes) {
+        std::cout << "  " << std::setw(8) << p.pid << "  " << std::left << std::setw(20) << p.name << std::right;
+        if(p.age < 0) std::cout << "  not published yet\n";
+        else std::cout << "  published " << std::fixed << std::setprecision(1) << p.age << "s ago\n";
+    }
+    std::cout << "\n" << std::left << std::setw(11) << "kind" << std::setw(32) << "name" << std::right
+              << std::setw(6) << "procs" << std::setw(14) << "calls" << std::setw(12) << "calls/s"
+              << std::setw(14) << "mean ms" << std::setw(14) << "total ms" << std::setw(14) << "value" << "\n";
+    for(auto& [key, row] : rows) {
+        auto was = previous.find(key);
+        // a process that exits takes its calls with it, so the count can drop between refreshes
+        std::int64_t calls = was != previous.end() ? (std::int64_t)row.count - (std::int64_t)was->second.count : 0;
+        double rate = calls > 0 && interval > 0 ? (double)calls / interval : 0.0;
+        auto kind = (profiler::StatKind)key.first;
+        bool timed = kind != profiler::StatKind::counter && kind != profiler::StatKind::gauge;
+        bool valued = kind == profiler::StatKind::counter || kind == profiler::StatKind::gauge || kind == profiler::StatKind::throughput;
+        std::cout << std::left << std::setw(11) << kindName(key.first) << std::setw(32) << key.second.substr(0, 31) << std::right
+                  << std::setw(6) << row.processes << std::setw(14) << row.count
+                  << std::fixed << std::setprecision(1) << std::setw(12) << rate << std::setprecision(4);
+        if(timed) std::cout << std::setw(14) << row.ns / 1e6 / (double)row.count << std::setw(14) << row.ns / 1e6;
+        else std::cout << std::setw(14) << "-" << std::setw(14) << "-";
+        // gauges are summed over the processes
+        if(valued) std::cout << std::setw(14) << row.value << "\n";
+        else std::cout << std::setw(14) << "-" << "\n";
+    }
+}
+
+}
+
+int main(int argc, char** argv) {
+    std::string name = "/profiler";
+    long refreshMs = 1000;
+    bool once = false;
+    std::vector<std::string> positional;
+    for(int i = 1; i < argc; i++) {
+        if(std::string(argv[i]) == "--once") once = true;
+        else positional.emplace_back(argv[i]);
+    }
+    if(positional.size() > 0) name = positional[0];
+    if(positional.size() > 1) refreshMs = std::stol(positional[1]);
+    if(positional.size() > 2 || refreshMs <= 0) {
+        std::cerr << "usage: " << argv[0] << " [segment name] [refresh ms] [--once]\n";
+        return 2;
+    }
+
+    profiler::SharedSegment segment;
+    if(!segment.open(name)) {
+        std::cerr << "could not open shared memory segment " << name << "\n";
+        return 1;
+    }
+
+    std::map<Key, Row> previous;
+    auto previousAt = std::chrono::steady_clock::now();
+    for(;;) {
+        std::map<Key, Row> rows;
+        std::vector<Process> processes;
+        read(segment, rows, processes);
+        auto now = std::chrono::steady_clock::now();
+        if(!once) std::cout << "\x1b[H\x1b[2J";
+        print(rows, previous, processes, std::chrono::duration<double>(now - previousAt).count());
+        std::cout << std::flush;
+        if(once) return 0;
+        previous = std::move(rows);
+        previousAt = now;
+        std::this_thread::sleep_for(std::chrono::milliseconds(refreshMs));
+    }
+}
+#else
+int main() {
+    std::cerr << "profiler-top needs POSIX shared memory\n";
+    return 1;
+}
+#endif